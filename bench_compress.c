@@ -0,0 +1,164 @@
+#include "gbc.h"
+#include "compress.h"
+#include "state.h"
+#include <assert.h>
+#include "test_util.h"
+
+/*
+Compressed size and speed of consecutive gbc_state_save() snapshots, one per frame.
+The game runs with random writes to VRAM, OAM, WRAM and the cartridge RAM, so the snapshots change
+like the ones of a game. Each snapshot is compressed on its own, against the one before it, and
+against a keyframe every REWIND_KEYFRAME_INTERVAL snapshots like gbc_rewind_frame() does.
+The time gbc_rewind_frame() takes per frame with REWIND_DEFAULT_BUDGET is measured while they are made,
+it saves, compresses and stores a snapshot.
+
+Built with the GBC_BUILD_TESTS option of CMakeLists.txt.
+
+    ./bench_compress game.gbc
+*/
+
+#define BENCH_SNAPSHOTS 240
+#define BENCH_WRITES 64     /* per frame */
+#define BENCH_REPEATS 10
+
+#define BENCH_PLAIN 0
+#define BENCH_PREVIOUS 1
+#define BENCH_KEYFRAME 2
+#define BENCH_MODES 3
+
+static void
+bench_audio_write(int8_t left, int8_t right)
+{
+}
+
+static void
+bench_write(gbc_t *gbc, uint16_t addr, uint8_t data)
+{
+    gbc->cpu.mem_write(gbc->cpu.mem_data, addr, data);
+}
+
+static void
+bench_frame(gbc_t *gbc)
+{
+    for (int i = 0; i < BENCH_WRITES; i++) {
+        switch (test_rand() % 4) {
+        case 0:
+            bench_write(gbc, IO_PORT_BASE + IO_PORT_VBK, test_rand() & 1);
+            bench_write(gbc, 0x8000 + test_rand() % 0x2000, test_rand());
+            break;
+        case 1:
+            bench_write(gbc, 0xfe00 + test_rand() % 160, test_rand());
+            break;
+        case 2:
+            bench_write(gbc, 0xc000 + test_rand() % 0x2000, test_rand());
+            break;
+        default:
+            bench_write(gbc, 0xa000 + test_rand() % 0x2000, test_rand());
+            break;
+        }
+    }
+
+    /* no gbc_io_cycle(), there is no frontend to poll the keypad from */
+    for (int i = 0; i < CYCLES_PER_FRAME; i++) {
+        gbc_cpu_cycle(&gbc->cpu);
+        gbc_timer_cycle(&gbc->timer);
+        gbc_graphic_cycle(&gbc->graphic);
+        gbc_audio_cycle(&gbc->audio);
+    }
+}
+
+static const uint8_t*
+bench_ref(uint8_t **snapshots, int i, int mode)
+{
+    switch (mode) {
+    case BENCH_PREVIOUS:
+        return i ? snapshots[i - 1] : NULL;
+    case BENCH_KEYFRAME:
+        return i % REWIND_KEYFRAME_INTERVAL ? snapshots[i - i % REWIND_KEYFRAME_INTERVAL] : NULL;
+    default:
+        return NULL;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    static gbc_t gbc;
+    static const char *names[BENCH_MODES] = {"plain", "previous", "keyframe"};
+    uint8_t *snapshots[BENCH_SNAPSHOTS];
+
+    if (argc < 2) {
+        printf("usage: %s game.gbc\n", argv[0]);
+        return 1;
+    }
+
+    test_seed(3);
+    int ret = gbc_init(&gbc, argv[1], NULL);
+    assert(ret == 0);
+    gbc.audio.audio_write = bench_audio_write;
+    /* enables the cartridge RAM */
+    bench_write(&gbc, 0x0000, 0x0a);
+    ret = gbc_rewind_init(&gbc.rewind, &gbc, REWIND_DEFAULT_BUDGET, 1);
+    assert(ret == 0);
+
+    size_t size = gbc_state_size(&gbc), state_size = 0;
+    size_t bound = COMPRESS_BOUND(size);
+    uint8_t *out = malloc(bound), *dec = malloc(size);
+    assert(out && dec);
+
+    uint64_t capture_time = 0, capture_max = 0;
+    for (int i = 0; i < BENCH_SNAPSHOTS; i++) {
+        bench_frame(&gbc);
+
+        uint64_t begin = get_time();
+        gbc_rewind_frame(&gbc.rewind);
+        uint64_t t = get_time() - begin;
+        capture_time += t;
+        capture_max = t > capture_max ? t : capture_max;
+
+        snapshots[i] = malloc(size);
+        assert(snapshots[i]);
+        state_size = gbc_state_save(&gbc, snapshots[i], size);
+        assert(state_size > 0);
+    }
+
+    printf("%d snapshots of %zu bytes\n", BENCH_SNAPSHOTS, state_size);
+    assert(gbc_rewind_count(&gbc.rewind) == BENCH_SNAPSHOTS);
+    printf("capture  %.1f us per frame, at most %.1f us, %zu bytes in the ring\n",
+        capture_time / 1e3 / BENCH_SNAPSHOTS, capture_max / 1e3, gbc_rewind_used(&gbc.rewind));
+
+    for (int mode = 0; mode < BENCH_MODES; mode++) {
+        uint64_t compress_time = 0, decompress_time = 0;
+        size_t total = 0;
+
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+            for (int i = 0; i < BENCH_SNAPSHOTS; i++) {
+                const uint8_t *ref = bench_ref(snapshots, i, mode);
+
+                uint64_t begin = get_time();
+                size_t n = gbc_compress(snapshots[i], ref, state_size, out, bound);
+                uint64_t middle = get_time();
+                ret = gbc_decompress(out, n, ref, dec, state_size);
+                uint64_t end = get_time();
+
+                assert(n > 0 && ret == 0 && memcmp(dec, snapshots[i], state_size) == 0);
+                compress_time += middle - begin;
+                decompress_time += end - middle;
+                if (!repeat)
+                    total += n;
+            }
+        }
+
+        double bytes = (double)state_size * BENCH_SNAPSHOTS * BENCH_REPEATS;
+        printf("%-8s %8zu bytes per snapshot, ratio %5.1f, compress %.2f GB/s, decompress %.2f GB/s\n",
+            names[mode], total / BENCH_SNAPSHOTS, (double)state_size * BENCH_SNAPSHOTS / total,
+            bytes / compress_time, bytes / decompress_time);
+    }
+
+    for (int i = 0; i < BENCH_SNAPSHOTS; i++)
+        free(snapshots[i]);
+    free(out);
+    free(dec);
+    gbc_rewind_destroy(&gbc.rewind);
+    return 0;
+}
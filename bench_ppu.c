@@ -0,0 +1,189 @@
+#include "gbc.h"
+#include <assert.h>
+#include "test_util.h"
+
+/*
+Time of the PPU alone in both accuracy tiers, the CPU is not stepped.
+VRAM, OAM and the palettes are random, the window is on and the BG scrolls every frame.
+Then the whole emulator runs with VRAM, OAM and palette writes between the cycles, in RENDER_MODE_LINE
+and RENDER_MODE_THREAD, and the CPU time of the emulation thread is measured too, the render thread
+does the drawing in the latter.
+
+Built with the GBC_BUILD_TESTS option of CMakeLists.txt.
+
+    ./bench_ppu game.gbc
+*/
+
+#define BENCH_FRAMES 300
+#define BENCH_WRITE_LINES 16    /* lines with a mid-line SCX write in the last run */
+#define BENCH_EMU_FRAMES 120
+#define BENCH_EMU_WRITE_CHANCE 64   /* a write every 64 cycles on average */
+
+static uint32_t _frames_crc;
+
+static void
+bench_audio_write(int8_t left, int8_t right)
+{
+}
+
+static void
+bench_frame_ready(void *udata, const void *buffer, uint16_t stride, uint8_t format)
+{
+    _frames_crc = _frames_crc * 31 + checksum_crc32((const uint8_t*)buffer, stride * VISIBLE_VERTICAL_PIXELS);
+}
+
+static void
+bench_setup(gbc_t *gbc, const char *rom, uint8_t accuracy)
+{
+    int ret = gbc_init(gbc, rom, NULL);
+    assert(ret == 0);
+    gbc->audio.audio_write = bench_audio_write;
+    gbc->graphic.frame_ready = bench_frame_ready;
+
+    test_seed(5);
+    _frames_crc = 0;
+    for (int i = 0; i < sizeof(gbc->graphic.vram); i++)
+        gbc->graphic.vram[i] = test_rand();
+    for (int i = 0; i < sizeof(gbc->mem.oam); i++)
+        gbc->mem.oam[i] = test_rand();
+    gbc->mem.oam_dirty = 1;
+    gbc_graphic_invalidate_tiles(&gbc->graphic);
+    for (int i = 0; i < 8; i++) {
+        for (int k = 0; k < 4; k++) {
+            gbc->mem.bg_palette[i].c[k] = test_rand() & 0x7fff;
+            gbc->mem.obj_palette[i].c[k] = test_rand() & 0x7fff;
+        }
+    }
+    gbc_mem_palette_refresh(&gbc->mem);
+
+    IO_PORT_WRITE(&gbc->mem, IO_PORT_LCDC, 0xf7);
+    IO_PORT_WRITE(&gbc->mem, IO_PORT_WY, 80);
+    IO_PORT_WRITE(&gbc->mem, IO_PORT_WX, 60);
+    ret = gbc_graphic_set_accuracy(&gbc->graphic, accuracy);
+    assert(ret == 0);
+}
+
+static void
+bench_step(gbc_t *gbc)
+{
+    gbc_graphic_cycle(&gbc->graphic);
+}
+
+/* runs until mode 3 of the line starts */
+static void
+bench_to_mode3(gbc_t *gbc, uint8_t scanline)
+{
+    while (!(gbc->graphic.scanline == scanline && gbc->graphic.mode == PPU_MODE_3))
+        bench_step(gbc);
+}
+
+static uint64_t
+bench_run(gbc_t *gbc, int mid_line_writes)
+{
+    uint64_t begin = get_time();
+    for (int f = 0; f < BENCH_FRAMES; f++) {
+        if (mid_line_writes) {
+            for (int i = 0; i < BENCH_WRITE_LINES; i++) {
+                bench_to_mode3(gbc, i * 8);
+                for (int d = 0; d < 80; d++)
+                    bench_step(gbc);
+                gbc->cpu.mem_write(gbc->cpu.mem_data, IO_PORT_BASE + IO_PORT_SCX, test_rand());
+            }
+        }
+        bench_to_mode3(gbc, VISIBLE_VERTICAL_PIXELS - 1);
+        bench_to_mode3(gbc, 0);
+        IO_PORT_WRITE(&gbc->mem, IO_PORT_SCX, IO_PORT_READ(&gbc->mem, IO_PORT_SCX) + 1);
+        IO_PORT_WRITE(&gbc->mem, IO_PORT_SCY, IO_PORT_READ(&gbc->mem, IO_PORT_SCY) + 3);
+    }
+    return get_time() - begin;
+}
+
+/* CPU time of the calling thread, the render thread is not counted */
+static uint64_t
+bench_thread_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+bench_emu_write(gbc_t *gbc)
+{
+    switch (test_rand() % 4) {
+    case 0:
+    case 1:
+        gbc->cpu.mem_write(gbc->cpu.mem_data, 0x8000 + test_rand() % 0x2000, test_rand());
+        break;
+    case 2:
+        gbc->cpu.mem_write(gbc->cpu.mem_data, 0xfe00 + test_rand() % 160, test_rand());
+        break;
+    default:
+        gbc->cpu.mem_write(gbc->cpu.mem_data, IO_PORT_BASE + IO_PORT_BCPS_BCPI, test_rand() & 0xbf);
+        gbc->cpu.mem_write(gbc->cpu.mem_data, IO_PORT_BASE + IO_PORT_BCPD_BGPD, test_rand());
+        break;
+    }
+}
+
+/* the frames crc, the whole emulator steps like gbc_run() does, without the keypad */
+static uint32_t
+bench_emulate(gbc_t *gbc, const char *rom, uint8_t mode)
+{
+    bench_setup(gbc, rom, PPU_ACCURACY_SCANLINE);
+    int ret = gbc_graphic_set_render_mode(&gbc->graphic, mode);
+    assert(ret == 0);
+
+    uint64_t begin = get_time(), begin_thread = bench_thread_time();
+    for (long i = 0; i < (long)CYCLES_PER_FRAME * BENCH_EMU_FRAMES; i++) {
+        if (test_rand() % BENCH_EMU_WRITE_CHANCE == 0)
+            bench_emu_write(gbc);
+        gbc_cpu_cycle(&gbc->cpu);
+        gbc_timer_cycle(&gbc->timer);
+        if (gbc->graphic.dots)
+            gbc->graphic.dots--;
+        else
+            gbc_graphic_event(&gbc->graphic);
+        gbc_audio_cycle(&gbc->audio);
+    }
+    gbc_graphic_sync(&gbc->graphic);
+    uint64_t time = get_time() - begin, time_thread = bench_thread_time() - begin_thread;
+
+    printf("render mode %d: %.3f ms/frame, %.3f ms/frame in the emulation thread, frames crc %08x\n", mode,
+        time / 1e6 / BENCH_EMU_FRAMES, time_thread / 1e6 / BENCH_EMU_FRAMES, _frames_crc);
+    /* stops the render thread */
+    gbc_graphic_set_render_mode(&gbc->graphic, RENDER_MODE_LINE);
+    return _frames_crc;
+}
+
+int
+main(int argc, char **argv)
+{
+    static gbc_t gbc;
+    uint64_t time[PPU_ACCURACIES];
+    uint32_t crc[PPU_ACCURACIES];
+
+    if (argc < 2) {
+        printf("usage: %s game.gbc\n", argv[0]);
+        return 1;
+    }
+
+    for (uint8_t accuracy = 0; accuracy < PPU_ACCURACIES; accuracy++) {
+        bench_setup(&gbc, argv[1], accuracy);
+        time[accuracy] = bench_run(&gbc, 0);
+        crc[accuracy] = _frames_crc;
+        printf("accuracy %d: %.3f ms/frame, frames crc %08x\n", accuracy,
+            time[accuracy] / 1e6 / BENCH_FRAMES, crc[accuracy]);
+    }
+    /* without mid-line writes the tiers only differ in timing */
+    assert(crc[PPU_ACCURACY_SCANLINE] == crc[PPU_ACCURACY_DOT]);
+
+    bench_setup(&gbc, argv[1], PPU_ACCURACY_DOT);
+    uint64_t with_writes = bench_run(&gbc, 1);
+    printf("accuracy %d with %d mid-line writes per frame: %.3f ms/frame, %.2f us per write\n",
+        PPU_ACCURACY_DOT, BENCH_WRITE_LINES, with_writes / 1e6 / BENCH_FRAMES,
+        ((double)with_writes - time[PPU_ACCURACY_DOT]) / 1e3 / BENCH_FRAMES / BENCH_WRITE_LINES);
+
+    uint32_t expect = bench_emulate(&gbc, argv[1], RENDER_MODE_LINE);
+    assert(bench_emulate(&gbc, argv[1], RENDER_MODE_THREAD) == expect);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "simd.h"
+#include "test_util.h"
+
+/*
+Time of every kernel in every implementation of gbc_simd_available(), on random input.
+The sizes are the ones the renderer and the post-processing use, a tile, a scanline and
+a frame row scaled by 4.
+
+Built with the GBC_BUILD_TESTS option of CMakeLists.txt.
+
+    ./bench_simd
+*/
+
+#define BENCH_CALLS 200000
+#define BENCH_MAX_SIMD 8
+#define BENCH_SCALE 4
+
+static uint8_t _tile[16];
+static gbc_simd_line_t _line;
+static uint32_t _palette[256];
+static uint8_t _colors[SIMD_LINE_PIXELS];
+static uint32_t _rows[3][SIMD_LINE_PIXELS];
+static uint8_t _frame[2][SIMD_LINE_PIXELS * 4 * BENCH_SCALE];
+static uint32_t _out[2][SIMD_LINE_PIXELS * BENCH_SCALE];
+
+/* keeps the calls from being optimized out */
+static volatile uint32_t _sink;
+
+static void
+bench_report(const char *kernel, uint64_t time)
+{
+    printf("    %-16s %8.1f ns\n", kernel, (double)time / BENCH_CALLS);
+}
+
+static void
+bench_simd(const gbc_simd_t *simd)
+{
+    uint64_t begin;
+    int first, last;
+    const int row_bytes = sizeof(_frame[0]);
+
+    printf("%s\n", simd->name);
+
+    begin = get_time();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        _tile[0] = i;
+        simd->tile_decode(_tile, (uint8_t*)_out[0], (uint8_t*)_out[1]);
+        _sink += _out[0][0];
+    }
+    bench_report("tile_decode", get_time() - begin);
+
+    begin = get_time();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        simd->line_compose(&_line, i & 1, _colors);
+        _sink += _colors[0];
+    }
+    bench_report("line_compose", get_time() - begin);
+
+    for (int bytes = 4; bytes >= 1; bytes /= 2) {
+        begin = get_time();
+        for (int i = 0; i < BENCH_CALLS; i++) {
+            simd->palette_lookup(_palette, _colors, (uint8_t*)_out[0], SIMD_LINE_PIXELS, bytes);
+            _sink += _out[0][0];
+        }
+        char kernel[32];
+        snprintf(kernel, sizeof(kernel), "palette_lookup %d", bytes);
+        bench_report(kernel, get_time() - begin);
+    }
+
+    begin = get_time();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        simd->row_scale(_rows[1], _out[0], SIMD_LINE_PIXELS, BENCH_SCALE);
+        _sink += _out[0][0];
+    }
+    bench_report("row_scale", get_time() - begin);
+
+    begin = get_time();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        simd->row_scale2x(_rows[0], _rows[1], _rows[2], _out[0], _out[1], SIMD_LINE_PIXELS);
+        _sink += _out[1][0];
+    }
+    bench_report("row_scale2x", get_time() - begin);
+
+    begin = get_time();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        simd->frame_blend(_frame[0], _frame[1], row_bytes, 128);
+        _sink += _frame[1][0];
+    }
+    bench_report("frame_blend", get_time() - begin);
+
+    /* the worst case, only the middle byte differs */
+    memcpy(_frame[1], _frame[0], row_bytes);
+    _frame[1][row_bytes / 2]++;
+    begin = get_time();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        simd->row_diff(_frame[0], _frame[1], row_bytes, &first, &last);
+        _sink += first + last;
+    }
+    bench_report("row_diff", get_time() - begin);
+}
+
+int
+main(int argc, char **argv)
+{
+    const gbc_simd_t *list[BENCH_MAX_SIMD];
+    int count = gbc_simd_available(list, BENCH_MAX_SIMD);
+
+    test_seed(7);
+
+    test_fill(_tile, sizeof(_tile));
+    test_fill(&_line, sizeof(_line));
+    for (int x = 0; x < SIMD_LINE_PIXELS; x++) {
+        _line.bg_color_id[x] &= 3;
+        _line.obj_color_id[x] &= 3;
+        _line.bg_priority[x] &= 1;
+        _line.obj_priority[x] &= 1;
+    }
+    test_fill(_palette, sizeof(_palette));
+    test_fill(_colors, sizeof(_colors));
+    /* few colors, so Scale2x finds edges */
+    for (int y = 0; y < 3; y++)
+        for (int x = 0; x < SIMD_LINE_PIXELS; x++)
+            _rows[y][x] = test_rand() & 0x01010101;
+    test_fill(_frame, sizeof(_frame));
+
+    for (int i = 0; i < count; i++)
+        bench_simd(list[i]);
+    return 0;
+}
@@ -0,0 +1,424 @@
+#include "boot.h"
+#include "gbc.h"
+
+typedef struct boot_io_value boot_io_value_t;
+typedef struct boot_compat_title boot_compat_title_t;
+typedef struct boot_compat_palette boot_compat_palette_t;
+
+struct boot_io_value
+{
+    uint16_t addr;
+    uint8_t data;
+};
+
+struct boot_compat_title
+{
+    uint8_t checksum;
+    uint8_t fourth_letter;    /* 0 means it doesn't matter */
+    uint8_t palette;          /* index of _compat_palettes */
+};
+
+/* offsets in _compat_colors, not palette numbers: a few combinations start mid-palette */
+struct boot_compat_palette
+{
+    uint8_t bg;
+    uint8_t obj0;
+    uint8_t obj1;
+};
+
+/*
+https://gbdev.io/pandocs/Power_Up_Sequence.html#hardware-registers
+These are written through the bus in this order, so every module sees the write.
+The audio registers are written with values that READ BACK as the documented ones,
+NR52 goes first otherwise the APU ignores the writes, NR14 re-triggers channel 1 like the boot sound does.
+*/
+static boot_io_value_t _post_boot_io[] = {
+    {0xff26, 0x80},    /* NR52 */
+    {0xff11, 0x80},    /* NR11 */
+    {0xff12, 0xf3},    /* NR12 */
+    {0xff13, 0xc1},    /* NR13 */
+    {0xff14, 0x87},    /* NR14 */
+    {0xff24, 0x77},    /* NR50 */
+    {0xff25, 0xf3},    /* NR51 */
+
+    {0xff00, 0xcf},    /* P1 */
+    {0xff01, 0x00},    /* SB */
+    {0xff02, 0x7f},    /* SC */
+    {0xff05, 0x00},    /* TIMA */
+    {0xff06, 0x00},    /* TMA */
+    {0xff07, 0xf8},    /* TAC */
+    {0xff42, 0x00},    /* SCY */
+    {0xff43, 0x00},    /* SCX */
+    {0xff45, 0x00},    /* LYC */
+    {0xff47, 0xfc},    /* BGP */
+    {0xff4a, 0x00},    /* WY */
+    {0xff4b, 0x00},    /* WX */
+    {0xff4f, 0x00},    /* VBK */
+    {0xff56, 0x3e},    /* RP */
+    {0xff70, 0xf8},    /* SVBK */
+};
+
+/*
+the registers below have side effects when written through the bus(DMA, HDMA), we set them directly,
+LCDC would restart the PPU, which has been running since the logo animation
+*/
+static boot_io_value_t _post_boot_io_raw[] = {
+    {0xff40, 0x91},    /* LCDC */
+    {0xff0f, 0xe1},    /* IF */
+    {0xff46, 0x00},    /* DMA */
+    {0xff4d, 0x7e},    /* KEY1 */
+    {0xff51, 0xff},    /* HDMA1 */
+    {0xff52, 0xff},    /* HDMA2 */
+    {0xff53, 0xff},    /* HDMA3 */
+    {0xff54, 0xff},    /* HDMA4 */
+    {0xff55, 0xff},    /* HDMA5 */
+};
+
+/* the (R) symbol, 1bpp */
+static uint8_t _logo_r_tile[] = {
+    0x3c, 0x42, 0xb9, 0xa5, 0xb9, 0xa5, 0x42, 0x3c
+};
+
+/*
+https://gbdev.io/pandocs/Power_Up_Sequence.html#compatibility-palettes
+Tables lifted from the CGB boot ROM. Combination 0 is used when the game is not in
+the title table. Titles after the first 65 share a checksum with another game and are
+told apart by the 4th letter of the title, the first matching entry wins.
+*/
+static uint16_t _compat_colors[] = {
+    0x7fff, 0x32bf, 0x00d0, 0x0000,    /* 0 */
+    0x639f, 0x4279, 0x15b0, 0x04cb,    /* 1 */
+    0x7fff, 0x6e31, 0x454a, 0x0000,    /* 2 */
+    0x7fff, 0x1bef, 0x0200, 0x0000,    /* 3 */
+    0x7fff, 0x421f, 0x1cf2, 0x0000,    /* 4 */
+    0x7fff, 0x5294, 0x294a, 0x0000,    /* 5 */
+    0x7fff, 0x03ff, 0x012f, 0x0000,    /* 6 */
+    0x7fff, 0x03ef, 0x01d6, 0x0000,    /* 7 */
+    0x7fff, 0x42b5, 0x3dc8, 0x0000,    /* 8 */
+    0x7e74, 0x03ff, 0x0180, 0x0000,    /* 9 */
+    0x67ff, 0x77ac, 0x1a13, 0x2d6b,    /* 10 */
+    0x7ed6, 0x4bff, 0x2175, 0x0000,    /* 11 */
+    0x53ff, 0x4a5f, 0x7e52, 0x0000,    /* 12 */
+    0x4fff, 0x7ed2, 0x3a4c, 0x1ce0,    /* 13 */
+    0x03ed, 0x7fff, 0x255f, 0x0000,    /* 14 */
+    0x036a, 0x021f, 0x03ff, 0x7fff,    /* 15 */
+    0x7fff, 0x01df, 0x0112, 0x0000,    /* 16 */
+    0x231f, 0x035f, 0x00f2, 0x0009,    /* 17 */
+    0x7fff, 0x03ea, 0x011f, 0x0000,    /* 18 */
+    0x299f, 0x001a, 0x000c, 0x0000,    /* 19 */
+    0x7fff, 0x027f, 0x001f, 0x0000,    /* 20 */
+    0x7fff, 0x03e0, 0x0206, 0x0120,    /* 21 */
+    0x7fff, 0x7eeb, 0x001f, 0x7c00,    /* 22 */
+    0x7fff, 0x3fff, 0x7e00, 0x001f,    /* 23 */
+    0x7fff, 0x03ff, 0x001f, 0x0000,    /* 24 */
+    0x03ff, 0x001f, 0x000c, 0x0000,    /* 25 */
+    0x7fff, 0x033f, 0x0193, 0x0000,    /* 26 */
+    0x0000, 0x4200, 0x037f, 0x7fff,    /* 27 */
+    0x7fff, 0x7e8c, 0x7c00, 0x0000,    /* 28 */
+    0x7fff, 0x1bef, 0x6180, 0x0000,    /* 29 */
+};
+
+static boot_compat_palette_t _compat_palettes[] = {
+    {116,  16,  16},    /* 0 */
+    { 72,  72,  72},    /* 1 */
+    { 80,  80,  80},    /* 2 */
+    { 96,  96,  96},    /* 3 */
+    { 36,  36,  36},    /* 4 */
+    {  0,   0,   0},    /* 5 */
+    {108, 108, 108},    /* 6 */
+    { 20,  20,  20},    /* 7 */
+    { 48,  48,  48},    /* 8 */
+    {104, 104, 104},    /* 9 */
+    { 32,  64,  32},    /* 10 */
+    {112,  16, 112},    /* 11 */
+    {  8,  16,   8},    /* 12 */
+    { 16,  12,  16},    /* 13 */
+    {116,  16, 116},    /* 14 */
+    {112, 112,  16},    /* 15 */
+    {  8,   8,  68},    /* 16 */
+    { 32,  64,  64},    /* 17 */
+    { 28,  16,  16},    /* 18 */
+    { 72,  16,  16},    /* 19 */
+    { 80,  16,  16},    /* 20 */
+    { 36,  76,  76},    /* 21 */
+    { 44,  15,  15},    /* 22 */
+    {  8,  68,  68},    /* 23 */
+    {  8,  16,  16},    /* 24 */
+    { 12,  16,  16},    /* 25 */
+    {  0, 112, 112},    /* 26 */
+    {  0,  12,  12},    /* 27 */
+    {  4,   0,   0},    /* 28 */
+    { 72,  72,  88},    /* 29 */
+    { 80,  80,  88},    /* 30 */
+    { 96,  96,  88},    /* 31 */
+    { 32,  64,  88},    /* 32 */
+    { 52,  68,  16},    /* 33 */
+    { 56, 111,   0},    /* 34 */
+    { 60, 111,  16},    /* 35 */
+    { 36,  76,  88},    /* 36 */
+    { 40,  64, 112},    /* 37 */
+    {112,  16,  92},    /* 38 */
+    {  8,  68,  88},    /* 39 */
+    {  8,  16,   0},    /* 40 */
+    { 12,  16, 112},    /* 41 */
+    {  0, 112,  12},    /* 42 */
+    { 16,  12, 112},    /* 43 */
+    { 16,  84, 112},    /* 44 */
+    {  0,  12, 112},    /* 45 */
+    {112, 100,  12},    /* 46 */
+    { 32,   0, 112},    /* 47 */
+    {112,  16,  12},    /* 48 */
+    { 24, 112,  12},    /* 49 */
+    {116,  16, 112},    /* 50 */
+};
+
+static boot_compat_title_t _compat_titles[] = {
+    {0x00, 0,    0},    /* Default */
+    {0x88, 0,    4},    /* ALLEY WAY */
+    {0x16, 0,    5},    /* YAKUMAN */
+    {0x36, 0,   35},    /* BASEBALL, GAME&WATCH 2 */
+    {0xd1, 0,   34},    /* TENNIS */
+    {0xdb, 0,    3},    /* TETRIS */
+    {0xf2, 0,   31},    /* QIX */
+    {0x3c, 0,   15},    /* DR.MARIO */
+    {0x8c, 0,   10},    /* RADARMISSION */
+    {0x92, 0,    5},    /* F1RACE */
+    {0x3d, 0,   19},    /* YOSSY NO TAMAGO */
+    {0x5c, 0,   36},
+    {0x58, 0,    7},    /* X */
+    {0xc9, 0,   37},    /* MARIOLAND2 */
+    {0x3e, 0,   30},    /* YOSSY NO COOKIE */
+    {0x70, 0,   44},    /* ZELDA */
+    {0x1d, 0,   21},
+    {0x59, 0,   32},
+    {0x69, 0,   31},    /* TETRIS FLASH */
+    {0x19, 0,   20},    /* DONKEY KONG */
+    {0x35, 0,    5},    /* MARIO'S PICROSS */
+    {0xa8, 0,   33},
+    {0x14, 0,   13},    /* POKEMON RED, GAMEBOYCAMERA G */
+    {0xaa, 0,   14},    /* POKEMON GREEN */
+    {0x75, 0,    5},    /* PICROSS 2 */
+    {0x95, 0,   29},    /* YOSSY NO PANEPON */
+    {0x99, 0,    5},    /* KIRAKIRA KIDS */
+    {0x34, 0,   18},    /* GAMEBOY GALLERY */
+    {0x6f, 0,    9},    /* POCKETCAMERA */
+    {0x15, 0,    3},
+    {0xff, 0,    2},    /* BALLOON KID */
+    {0x97, 0,   26},    /* KINGOFTHEZOO */
+    {0x4b, 0,   25},    /* DMG FOOTBALL */
+    {0x90, 0,   25},    /* WORLD CUP */
+    {0x17, 0,   41},    /* OTHELLO */
+    {0x10, 0,   42},    /* SUPER RC PRO-AM */
+    {0x39, 0,   26},    /* DYNABLASTER */
+    {0xf7, 0,   45},    /* BOY AND BLOB GB2 */
+    {0xf6, 0,   42},    /* MEGAMAN */
+    {0xa2, 0,   45},    /* STAR WARS-NOA */
+    {0x49, 0,   36},
+    {0x4e, 0,   38},    /* WAVERACE */
+    {0x43, 0,   26},
+    {0x68, 0,   42},    /* LOLO2 */
+    {0xe0, 0,   30},    /* YOSHI'S COOKIE */
+    {0x8b, 0,   41},    /* MYSTIC QUEST */
+    {0xf0, 0,   34},
+    {0xce, 0,   34},    /* TOPRANKINGTENNIS */
+    {0x0c, 0,    5},    /* MANSELL */
+    {0x29, 0,   42},    /* MEGAMAN3 */
+    {0xe8, 0,    6},    /* SPACE INVADERS */
+    {0xb7, 0,    5},    /* GAME&WATCH */
+    {0x86, 0,   33},    /* DONKEYKONGLAND95 */
+    {0x9a, 0,   25},    /* ASTEROIDS/MISCMD */
+    {0x52, 0,   42},    /* STREET FIGHTER 2 */
+    {0x01, 0,   42},    /* DEFENDER/JOUST */
+    {0x9d, 0,   40},    /* KILLERINSTINCT95 */
+    {0x71, 0,    2},    /* TETRIS BLAST */
+    {0x9c, 0,   16},    /* PINOCCHIO */
+    {0xbd, 0,   25},
+    {0x5d, 0,   42},    /* BA.TOSHINDEN */
+    {0x6d, 0,   42},    /* NETTOU KOF 95 */
+    {0x67, 0,    5},
+    {0x3f, 0,    0},    /* TETRIS PLUS */
+    {0x6b, 0,   39},    /* DONKEYKONGLAND 3 */
+    {0xb3, 'B', 36},
+    {0x46, 'E', 22},    /* SUPER MARIOLAND */
+    {0x28, 'F', 25},    /* GOLF */
+    {0xa5, 'A',  6},    /* SOLARSTRIKER */
+    {0xc6, 'A', 32},    /* GBWARS */
+    {0xd3, 'R', 12},    /* KAERUNOTAMENI */
+    {0x27, 'B', 36},
+    {0x61, 'E', 11},    /* POKEMON BLUE */
+    {0x18, 'K', 39},    /* DONKEYKONGLAND */
+    {0x66, 'E', 18},    /* GAMEBOY GALLERY2 */
+    {0x6a, 'K', 39},    /* DONKEYKONGLAND 2 */
+    {0xbf, ' ', 24},    /* KID ICARUS */
+    {0x0d, 'R', 31},    /* TETRIS2 */
+    {0xf4, '-', 50},
+    {0xb3, 'U', 17},    /* MOGURANYA */
+    {0x46, 'R', 46},
+    {0x28, 'A',  6},    /* GALAGA&GALAXIAN */
+    {0xa5, 'R', 27},    /* BT2RAGNAROKWORLD */
+    {0xc6, ' ',  0},    /* KEN GRIFFEY JR */
+    {0xd3, 'I', 47},
+    {0x27, 'N', 41},    /* MAGNETIC SOCCER */
+    {0x61, 'A', 41},    /* VEGAS STAKES */
+    {0x18, 'I',  0},
+    {0x66, 'L',  0},    /* MILLI/CENTI/PEDE */
+    {0x6a, 'I', 19},    /* MARIO & YOSHI */
+    {0xbf, 'C', 34},    /* SOCCER */
+    {0x0d, 'E', 23},    /* POKEBOM */
+    {0xf4, ' ', 18},    /* G&W GALLERY */
+    {0xb3, 'R', 29},    /* TETRIS ATTACK */
+};
+
+static void
+boot_write(gbc_t *gbc, uint16_t addr, uint8_t data)
+{
+    gbc->mem.write(&gbc->mem, addr, data);
+}
+
+static void
+boot_write_palette(gbc_t *gbc, uint8_t ps_port, uint8_t idx, uint16_t *colors)
+{
+    /* auto increment from the first byte of palette 'idx' */
+    boot_write(gbc, IO_PORT_ADDR(ps_port), 0x80 | (idx * 8));
+    for (int i = 0; i < 4; i++) {
+        boot_write(gbc, IO_PORT_ADDR(ps_port + 1), colors[i] & 0xff);
+        boot_write(gbc, IO_PORT_ADDR(ps_port + 1), colors[i] >> 8);
+    }
+}
+
+/* 4 bits -> 8 bits, every bit is doubled */
+static uint8_t
+boot_double_nibble(uint8_t nibble)
+{
+    uint8_t r = 0;
+    for (int i = 3; i >= 0; i--) {
+        r <<= 2;
+        if (nibble & (1 << i))
+            r |= 0x03;
+    }
+    return r;
+}
+
+static void
+boot_load_logo(gbc_t *gbc, cartridge_t *cart)
+{
+    uint16_t addr = BOOT_LOGO_TILES_ADDR;
+
+    /* every logo byte makes 4 rows of a tile, each nibble is scaled 2x, only bitplane 0 is used */
+    for (int i = 0; i < sizeof(cart->nintendo_logo); i++) {
+        uint8_t hi = boot_double_nibble(cart->nintendo_logo[i] >> 4);
+        uint8_t lo = boot_double_nibble(cart->nintendo_logo[i] & 0x0f);
+        boot_write(gbc, addr, hi); addr += 2;
+        boot_write(gbc, addr, hi); addr += 2;
+        boot_write(gbc, addr, lo); addr += 2;
+        boot_write(gbc, addr, lo); addr += 2;
+    }
+
+    for (int i = 0; i < sizeof(_logo_r_tile); i++) {
+        boot_write(gbc, addr, _logo_r_tile[i]);
+        addr += 2;
+    }
+
+    for (int i = 0; i < BOOT_LOGO_TILES_PER_ROW; i++) {
+        boot_write(gbc, BOOT_LOGO_TILEMAP_ROW_0 + i, i + 1);
+        boot_write(gbc, BOOT_LOGO_TILEMAP_ROW_1 + i, i + 1 + BOOT_LOGO_TILES_PER_ROW);
+    }
+    boot_write(gbc, BOOT_LOGO_R_TILEMAP, BOOT_LOGO_R_TILE);
+}
+
+static boot_compat_palette_t*
+boot_compat_palette(cartridge_t *cart)
+{
+    uint8_t *data = (uint8_t*)cart;
+
+    /* only Nintendo's games are in the table */
+    uint8_t nintendo = cart->old_licensee_code == 0x01 ||
+        (cart->old_licensee_code == 0x33 && data[0x144] == '0' && data[0x145] == '1');
+
+    if (!nintendo)
+        return &_compat_palettes[0];
+
+    uint8_t checksum = 0;
+    for (int i = BOOT_TITLE_CHECKSUM_BEGIN; i <= BOOT_TITLE_CHECKSUM_END; i++)
+        checksum += data[i];
+
+    for (int i = 0; i < sizeof(_compat_titles) / sizeof(boot_compat_title_t); i++) {
+        boot_compat_title_t *t = &_compat_titles[i];
+        if (t->checksum != checksum)
+            continue;
+        /* some checksums collide, the boot ROM uses the 4th letter of the title to tell them apart */
+        if (t->fourth_letter && t->fourth_letter != cart->title[3])
+            continue;
+        LOG_INFO("[BOOT] Compatibility palette %d, checksum %x\n", t->palette, checksum);
+        return &_compat_palettes[t->palette];
+    }
+
+    return &_compat_palettes[0];
+}
+
+void
+gbc_boot_hle(gbc_t *gbc)
+{
+    cartridge_t *cart = gbc->mbc.cart;
+    uint8_t cgb_mode = cart->cart_cgb_flag & 0x80;
+    gbc_cpu_t *cpu = &gbc->cpu;
+
+    /* https://gbdev.io/pandocs/Power_Up_Sequence.html#cpu-registers */
+    WRITE_R8(cpu, REG_A, 0x11);
+    WRITE_R8(cpu, REG_F, FLAG_Z);
+    WRITE_R8(cpu, REG_B, 0x00);
+    WRITE_R8(cpu, REG_C, 0x00);
+    if (cgb_mode) {
+        WRITE_R8(cpu, REG_D, 0xff);
+        WRITE_R8(cpu, REG_E, 0x56);
+        WRITE_R8(cpu, REG_H, 0x00);
+        WRITE_R8(cpu, REG_L, 0x0d);
+    } else {
+        WRITE_R8(cpu, REG_D, 0x00);
+        WRITE_R8(cpu, REG_E, 0x08);
+        WRITE_R8(cpu, REG_H, 0x00);
+        WRITE_R8(cpu, REG_L, 0x7c);
+    }
+    WRITE_R16(cpu, REG_SP, 0xfffe);
+    WRITE_R16(cpu, REG_PC, 0x0100);
+    cpu->ime = 0;
+    cpu->ier = 0;
+
+    gbc->mem.boot_rom_enabled = 0;
+
+    for (int i = 0; i < sizeof(_post_boot_io) / sizeof(boot_io_value_t); i++)
+        boot_write(gbc, _post_boot_io[i].addr, _post_boot_io[i].data);
+
+    for (int i = 0; i < sizeof(_post_boot_io_raw) / sizeof(boot_io_value_t); i++)
+        IO_PORT_WRITE(&gbc->mem, IO_ADDR_PORT(_post_boot_io_raw[i].addr), _post_boot_io_raw[i].data);
+
+    /*
+    The boot ROM hands over in V-BLANK, on line 153 which already reads LY 0, STAT is 0x85.
+    The first frame the game draws is shown, there is no LCD warm-up.
+    */
+    gbc->graphic.mode = PPU_MODE_1;
+    gbc->graphic.scanline = 0;
+    gbc->graphic.dots = PPU_MODE_1_DOTS;
+    gbc->graphic.lcd_warmup = 0;
+    IO_PORT_WRITE(&gbc->mem, IO_PORT_LY, 0);
+    IO_PORT_WRITE(&gbc->mem, IO_PORT_STAT, 0x80 | STAT_LYC_LY | PPU_MODE_1);
+
+    boot_load_logo(gbc, cart);
+
+    if (cgb_mode) {
+        /* CGB games get all-white BG palettes, OBJ palettes are left uninitialized(zeros here) */
+        uint16_t white[4] = {0x7fff, 0x7fff, 0x7fff, 0x7fff};
+        for (int i = 0; i < 8; i++)
+            boot_write_palette(gbc, IO_PORT_BCPS_BCPI, i, white);
+    } else {
+        boot_compat_palette_t *p = boot_compat_palette(cart);
+        boot_write_palette(gbc, IO_PORT_BCPS_BCPI, 0, &_compat_colors[p->bg]);
+        boot_write_palette(gbc, IO_PORT_OCPS_OCPI, 0, &_compat_colors[p->obj0]);
+        boot_write_palette(gbc, IO_PORT_OCPS_OCPI, 1, &_compat_colors[p->obj1]);
+        IO_PORT_WRITE(&gbc->mem, IO_PORT_KEY0, 0x04);   /* DMG compatibility mode */
+        IO_PORT_WRITE(&gbc->mem, IO_PORT_OPRI, 0x01);   /* OBJ priority by X coordinate */
+    }
+
+    IO_PORT_WRITE(&gbc->mem, IO_PORT_BCPS_BCPI, 0x00);
+    IO_PORT_WRITE(&gbc->mem, IO_PORT_OCPS_OCPI, 0x00);
+}
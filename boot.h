@@ -0,0 +1,36 @@
+#ifndef _BOOT_H
+#define _BOOT_H
+
+#include "gbc.h"
+
+/*
+HLE(high level emulation) boot.
+Instead of running a boot ROM at 0x0000 for a few seconds of emulated time, we write
+the state the CGB boot ROM leaves behind when it jumps to the cartridge entry point 0x0100.
+https://gbdev.io/pandocs/Power_Up_Sequence.html
+
+What is synthesised:
+    - CPU registers (CGB mode and DMG-compatibility mode have different values)
+    - IO ports, audio registers included
+    - BG/OBJ palette RAM, in DMG-compatibility mode the palettes are picked from the title checksum
+    - VRAM, the logo tiles and tilemap
+
+Things that are NOT reproduced:
+    - The CGB boot ROM draws its own(bigger) logo, we place the logo the way the DMG boot ROM does.
+    - The palette picked by holding buttons during the boot animation.
+    - DIV and the PPU position, they depend on how long the boot animation runs.
+*/
+
+#define BOOT_TITLE_CHECKSUM_BEGIN 0x134
+#define BOOT_TITLE_CHECKSUM_END   0x143
+
+#define BOOT_LOGO_TILES_ADDR      0x8010
+#define BOOT_LOGO_TILEMAP_ROW_0   0x9904
+#define BOOT_LOGO_TILEMAP_ROW_1   0x9924
+#define BOOT_LOGO_TILES_PER_ROW   12
+#define BOOT_LOGO_R_TILE          0x19
+#define BOOT_LOGO_R_TILEMAP       0x9910
+
+void gbc_boot_hle(gbc_t *gbc);
+
+#endif
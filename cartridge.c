@@ -51,10 +51,9 @@ cartridge_load(uint8_t *data)
         return NULL;
     }
     
-    if (cartridge->cart_cgb_flag != 0x80 && cartridge->cart_cgb_flag != 0xC0) {
-        LOG_ERROR("Invalid CGB flag\n");
-        return NULL;
-    }
+    /* https://gbdev.io/pandocs/The_Cartridge_Header.html#0143--cgb-flag */
+    if (!(cartridge->cart_cgb_flag & 0x80))
+        LOG_INFO("DMG cartridge, running in DMG compatibility mode\n");
 
     LOG_INFO("Title: %s\n", cartridge->title);
     LOG_INFO("ROM Size: %dk\n", cartridge_rom_size(cartridge) / 1024);
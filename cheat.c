@@ -0,0 +1,285 @@
+#include <ctype.h>
+#include "cheat.h"
+
+static int
+hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c = toupper(c);
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int
+hex_digits(const char *s, int n, uint8_t *out)
+{
+    for (int i = 0; i < n; i++) {
+        int d = hex_digit(s[i]);
+        if (d < 0)
+            return 1;
+        out[i] = d;
+    }
+    return 0;
+}
+
+/* https://gbdev.io/pandocs/Shark_Cheats.html, ttvvllhh */
+static int
+parse_gameshark(gbc_cheat_code_t *c, const char *code)
+{
+    uint8_t d[GAMESHARK_CODE_LEN];
+    if (hex_digits(code, GAMESHARK_CODE_LEN, d))
+        return 1;
+
+    c->type = CHEAT_TYPE_GAMESHARK;
+    c->bank = (d[0] << 4) | d[1];
+    c->data = (d[2] << 4) | d[3];
+    c->addr = (d[6] << 12) | (d[7] << 8) | (d[4] << 4) | d[5];
+    return 0;
+}
+
+/*
+ABC-DEF-GHI
+AB is the new data, FCDE xor 0xF000 is the address
+GI rotated right by 2 then xor 0xBA is the data to compare with, H is not used
+*/
+static int
+parse_gamegenie(gbc_cheat_code_t *c, const char *code, int len)
+{
+    uint8_t d[9];
+    if (code[3] != '-' || hex_digits(code, 3, d) || hex_digits(code + 4, 3, d + 3))
+        return 1;
+
+    c->type = CHEAT_TYPE_GAMEGENIE;
+    c->data = (d[0] << 4) | d[1];
+    c->addr = ((d[5] << 12) | (d[2] << 8) | (d[3] << 4) | d[4]) ^ 0xf000;
+    c->has_compare = 0;
+
+    if (len == GAMEGENIE_CODE_LEN) {
+        if (code[7] != '-' || hex_digits(code + 8, 3, d + 6))
+            return 1;
+        uint8_t gi = (d[6] << 4) | d[8];
+        c->compare = ((gi >> 2) | (gi << 6)) ^ 0xba;
+        c->has_compare = 1;
+    }
+
+    /* game genie patches ROM only */
+    if (c->addr > ROM_BANK_N_END)
+        return 1;
+    return 0;
+}
+
+static uint8_t
+cheat_rom_read(void *udata, uint16_t addr)
+{
+    gbc_cheat_t *cheat = (gbc_cheat_t*)udata;
+    uint8_t data = cheat->rom_read(cheat->rom_udata, addr);
+    uint8_t page = addr >> CHEAT_ROM_PAGE_SHIFT;
+
+    if (!(cheat->rom_pages[page / 8] & (1 << (page % 8))))
+        return data;
+
+    for (int i = 0; i < cheat->count; i++) {
+        gbc_cheat_code_t *c = &cheat->codes[i];
+        if (c->type != CHEAT_TYPE_GAMEGENIE || !c->enabled || c->addr != addr)
+            continue;
+        /* the compare value makes sure we only patch the right ROM bank */
+        if (c->has_compare && c->compare != data)
+            continue;
+        return c->data;
+    }
+    return data;
+}
+
+static void
+cheat_vblank(void *udata)
+{
+    gbc_cheat_t *cheat = (gbc_cheat_t*)udata;
+    gbc_memory_t *mem = cheat->mem;
+
+    for (int i = 0; i < cheat->count; i++) {
+        gbc_cheat_code_t *c = &cheat->codes[i];
+        if (c->type != CHEAT_TYPE_GAMESHARK || !c->enabled)
+            continue;
+
+        if ((c->bank & GAMESHARK_TYPE_WRAM_BANK) && IN_RANGE(c->addr, WRAM_BANK_N_BEGIN, WRAM_BANK_N_END)) {
+            /* 0x8X writes to WRAM bank X whatever SVBK is */
+            uint8_t bank = c->bank & (WRAM_BANKS - 1);
+            if (bank == 0)
+                bank = 1;
+            mem->wram[bank * WRAM_BANK_SIZE + c->addr - WRAM_BANK_N_BEGIN] = c->data;
+        } else {
+            mem->write(mem, c->addr, c->data);
+        }
+    }
+}
+
+/* hook or unhook the V-BLANK callback and the ROM overlay, depending on the enabled codes */
+static void
+cheat_update_hooks(gbc_cheat_t *cheat)
+{
+    uint8_t gameshark = 0, gamegenie = 0;
+    memset(cheat->rom_pages, 0, sizeof(cheat->rom_pages));
+
+    for (int i = 0; i < cheat->count; i++) {
+        gbc_cheat_code_t *c = &cheat->codes[i];
+        if (!c->enabled)
+            continue;
+        if (c->type == CHEAT_TYPE_GAMESHARK) {
+            gameshark = 1;
+        } else {
+            uint8_t page = c->addr >> CHEAT_ROM_PAGE_SHIFT;
+            cheat->rom_pages[page / 8] |= 1 << (page % 8);
+            gamegenie = 1;
+        }
+    }
+
+    cheat->graphic->vblank = gameshark ? cheat_vblank : NULL;
+    cheat->graphic->vblank_udata = cheat;
+
+    memory_map_entry_t *bank0 = &cheat->mem->map[ROM_BANK_0_ID - 1];
+    memory_map_entry_t *bankn = &cheat->mem->map[ROM_BANK_N_ID - 1];
+    if (gamegenie) {
+        bank0->read = bankn->read = cheat_rom_read;
+        bank0->udata = bankn->udata = cheat;
+    } else {
+        bank0->read = bankn->read = cheat->rom_read;
+        bank0->udata = bankn->udata = cheat->rom_udata;
+    }
+}
+
+void
+gbc_cheat_init(gbc_cheat_t *cheat)
+{
+    memset(cheat, 0, sizeof(gbc_cheat_t));
+}
+
+void
+gbc_cheat_connect(gbc_cheat_t *cheat, gbc_memory_t *mem, gbc_graphic_t *graphic)
+{
+    cheat->mem = mem;
+    cheat->graphic = graphic;
+
+    /* both ROM entries are served by the MBC */
+    memory_map_entry_t *entry = &mem->map[ROM_BANK_0_ID - 1];
+    if (entry->id == 0) {
+        LOG_ERROR("[CHEAT] ROM is not mapped, connect the MBC first\n");
+        abort();
+    }
+    cheat->rom_read = entry->read;
+    cheat->rom_udata = entry->udata;
+}
+
+void
+gbc_cheat_set_rom(gbc_cheat_t *cheat, uint8_t *rom, uint32_t size)
+{
+    cheat->rom_crc = checksum_crc32(rom, size);
+}
+
+int
+gbc_cheat_add(gbc_cheat_t *cheat, const char *code, uint8_t enabled)
+{
+    if (cheat->count == MAX_CHEATS) {
+        LOG_ERROR("[CHEAT] Too many cheats\n");
+        return 1;
+    }
+
+    gbc_cheat_code_t *c = &cheat->codes[cheat->count];
+    memset(c, 0, sizeof(gbc_cheat_code_t));
+
+    int len = strlen(code);
+    int r = 1;
+    if (len == GAMESHARK_CODE_LEN) {
+        r = parse_gameshark(c, code);
+    } else if (len == GAMEGENIE_CODE_LEN || len == GAMEGENIE_SHORT_CODE_LEN) {
+        r = parse_gamegenie(c, code, len);
+    }
+
+    if (r) {
+        LOG_ERROR("[CHEAT] Invalid code %s\n", code);
+        return 1;
+    }
+
+    strncpy(c->code, code, CHEAT_CODE_SIZE - 1);
+    c->enabled = enabled ? 1 : 0;
+    cheat->count++;
+
+    LOG_INFO("[CHEAT] %s %s: addr %x data %x\n",
+        c->type == CHEAT_TYPE_GAMESHARK ? "GameShark" : "Game Genie", c->code, c->addr, c->data);
+
+    cheat_update_hooks(cheat);
+    return 0;
+}
+
+void
+gbc_cheat_remove(gbc_cheat_t *cheat, uint8_t idx)
+{
+    if (idx >= cheat->count)
+        return;
+
+    memmove(&cheat->codes[idx], &cheat->codes[idx + 1], (cheat->count - idx - 1) * sizeof(gbc_cheat_code_t));
+    cheat->count--;
+    cheat_update_hooks(cheat);
+}
+
+void
+gbc_cheat_enable(gbc_cheat_t *cheat, uint8_t idx, uint8_t enabled)
+{
+    if (idx >= cheat->count)
+        return;
+
+    cheat->codes[idx].enabled = enabled ? 1 : 0;
+    cheat_update_hooks(cheat);
+}
+
+static void
+cheat_file_path(gbc_cheat_t *cheat, char *path, int size)
+{
+    snprintf(path, size, "%s/%08x%s", CHEAT_DIR, cheat->rom_crc, CHEAT_FILE_EXT);
+}
+
+int
+gbc_cheat_load(gbc_cheat_t *cheat)
+{
+    char path[64];
+    char line[64];
+    char code[CHEAT_CODE_SIZE];
+    int enabled;
+
+    cheat_file_path(cheat, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 1;
+
+    cheat->count = 0;
+    while (fgets(line, sizeof(line), f)) {
+        enabled = 1;
+        if (sscanf(line, "%15s %d", code, &enabled) < 1)
+            continue;
+        gbc_cheat_add(cheat, code, enabled);
+    }
+    fclose(f);
+
+    LOG_INFO("[CHEAT] Loaded %d codes from %s\n", cheat->count, path);
+    cheat_update_hooks(cheat);
+    return 0;
+}
+
+int
+gbc_cheat_save(gbc_cheat_t *cheat)
+{
+    char path[64];
+
+    cheat_file_path(cheat, path, sizeof(path));
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        LOG_ERROR("[CHEAT] Failed to open %s, does the directory '%s' exist?\n", path, CHEAT_DIR);
+        return 1;
+    }
+
+    for (int i = 0; i < cheat->count; i++)
+        fprintf(f, "%s %d\n", cheat->codes[i].code, cheat->codes[i].enabled);
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef _CHEAT_H
+#define _CHEAT_H
+
+#include "common.h"
+#include "memory.h"
+#include "graphic.h"
+
+/*
+Cheat codes.
+GameShark codes are RAM writes, they are applied once per frame when the PPU enters V-BLANK.
+Game Genie codes are ROM patches, they are applied as an overlay on the ROM read path.
+
+When no code is enabled, nothing is hooked: the V-BLANK callback is NULL and the ROM memory
+map entries point to mbc_read() directly, so the bus is exactly as fast as without cheats.
+
+Codes are saved per ROM in CHEAT_DIR/<crc32 of the ROM>.cht, one code per line: "<code> <enabled>"
+*/
+
+#define MAX_CHEATS 64
+#define CHEAT_CODE_SIZE 16
+
+#define CHEAT_TYPE_GAMESHARK 1
+#define CHEAT_TYPE_GAMEGENIE 2
+
+#define CHEAT_DIR "cheats"
+#define CHEAT_FILE_EXT ".cht"
+
+/* the overlay is enabled per 256 bytes ROM page */
+#define CHEAT_ROM_PAGE_SHIFT 8
+#define CHEAT_ROM_PAGES ((ROM_BANK_N_END + 1) >> CHEAT_ROM_PAGE_SHIFT)
+
+/* https://gbdev.io/pandocs/Shark_Cheats.html */
+#define GAMESHARK_CODE_LEN 8
+#define GAMESHARK_TYPE_WRAM_BANK 0x80
+/* https://gbdev.io/pandocs/Shark_Cheats.html#game-genie */
+#define GAMEGENIE_CODE_LEN 11       /* ABC-DEF-GHI */
+#define GAMEGENIE_SHORT_CODE_LEN 7  /* ABC-DEF, no compare value */
+
+typedef struct gbc_cheat gbc_cheat_t;
+typedef struct gbc_cheat_code gbc_cheat_code_t;
+
+struct gbc_cheat_code
+{
+    char code[CHEAT_CODE_SIZE];     /* as typed by the user */
+    uint8_t type;
+    uint8_t enabled;
+    uint16_t addr;
+    uint8_t data;
+    uint8_t compare;                /* game genie only */
+    uint8_t has_compare;
+    uint8_t bank;                   /* gameshark only, the code type byte */
+};
+
+struct gbc_cheat
+{
+    gbc_cheat_code_t codes[MAX_CHEATS];
+    uint8_t count;
+    uint8_t rom_pages[CHEAT_ROM_PAGES / 8];   /* pages having at least one enabled game genie code */
+    uint32_t rom_crc;
+
+    /* the original ROM read path we are overlaying */
+    memory_read rom_read;
+    void *rom_udata;
+
+    gbc_memory_t *mem;
+    gbc_graphic_t *graphic;
+};
+
+void gbc_cheat_init(gbc_cheat_t *cheat);
+void gbc_cheat_connect(gbc_cheat_t *cheat, gbc_memory_t *mem, gbc_graphic_t *graphic);
+void gbc_cheat_set_rom(gbc_cheat_t *cheat, uint8_t *rom, uint32_t size);
+
+/* returns 0 on success */
+int gbc_cheat_add(gbc_cheat_t *cheat, const char *code, uint8_t enabled);
+void gbc_cheat_remove(gbc_cheat_t *cheat, uint8_t idx);
+void gbc_cheat_enable(gbc_cheat_t *cheat, uint8_t idx, uint8_t enabled);
+
+/* load/save the codes of the current ROM, returns 0 on success */
+int gbc_cheat_load(gbc_cheat_t *cheat);
+int gbc_cheat_save(gbc_cheat_t *cheat);
+
+#endif
@@ -0,0 +1,202 @@
+#include "compress.h"
+
+#define DELTA(src, ref, i) ((ref) ? (src)[i] ^ (ref)[i] : (src)[i])
+
+static inline uint64_t
+load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void
+store64(uint8_t *p, uint64_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline uint64_t
+load_delta64(const uint8_t *src, const uint8_t *ref, size_t i)
+{
+    return ref ? load64(src + i) ^ load64(ref + i) : load64(src + i);
+}
+
+/* the length of the run of v starting at pos, in the delta */
+static size_t
+run_length(const uint8_t *src, const uint8_t *ref, size_t pos, size_t size, uint8_t v)
+{
+    uint64_t word = v * 0x0101010101010101ULL;
+    size_t i = pos;
+
+    while (i + 8 <= size) {
+        uint64_t diff = load_delta64(src, ref, i) ^ word;
+        if (diff) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            /* the lowest set bit is in the first differing byte */
+            return i + (__builtin_ctzll(diff) >> 3) - pos;
+#else
+            break;
+#endif
+        }
+        i += 8;
+    }
+    while (i < size && DELTA(src, ref, i) == v)
+        i++;
+    return i - pos;
+}
+
+/* https://graphics.stanford.edu/~seander/bithacks.html#ZeroInWord */
+#define HAS_ZERO_BYTE(v) (((v) - 0x0101010101010101ULL) & ~(v) & 0x8080808080808080ULL)
+
+static uint8_t *
+emit_op(uint8_t *out, uint8_t op, size_t len)
+{
+    if (len <= COMPRESS_SHORT_LEN) {
+        *out++ = op | (len - 1);
+        return out;
+    }
+
+    *out++ = op | COMPRESS_LEN_MASK;
+    len -= COMPRESS_SHORT_LEN + 1;
+    while (len >= 0x80) {
+        *out++ = (len & 0x7f) | 0x80;
+        len >>= 7;
+    }
+    *out++ = len;
+    return out;
+}
+
+static uint8_t *
+emit_literal(uint8_t *out, const uint8_t *src, const uint8_t *ref, size_t pos, size_t n)
+{
+    out = emit_op(out, COMPRESS_OP_LITERAL, n);
+    if (ref) {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            store64(out + i, load64(src + pos + i) ^ load64(ref + pos + i));
+        for (; i < n; i++)
+            out[i] = src[pos + i] ^ ref[pos + i];
+    } else {
+        memcpy(out, src + pos, n);
+    }
+    return out + n;
+}
+
+size_t
+gbc_compress(const uint8_t *src, const uint8_t *ref, size_t size, uint8_t *dst, size_t dst_size)
+{
+    uint8_t *out = dst;
+    size_t avail = dst_size;
+    size_t literal = 0;     /* where the pending literal begins */
+    size_t pos = 0;
+
+    while (pos < size) {
+        uint8_t v = DELTA(src, ref, pos);
+        size_t n = run_length(src, ref, pos, size, v);
+
+        /* a short run is cheaper as part of the literal, except a zero run at the end */
+        if (n < COMPRESS_MIN_RUN && (v != 0 || pos + n != size)) {
+            pos += n;
+            /* skip 7 bytes at once while no byte equals the next one, no run can start there */
+            while (pos + 8 <= size && !HAS_ZERO_BYTE(load_delta64(src, ref, pos - 1) ^ load_delta64(src, ref, pos)))
+                pos += 7;
+            continue;
+        }
+
+        size_t need = (pos - literal) + COMPRESS_MAX_OP_SIZE * 2 + 1;
+        if (avail < need)
+            return 0;
+
+        uint8_t *begin = out;
+        if (pos > literal)
+            out = emit_literal(out, src, ref, literal, pos - literal);
+        out = emit_op(out, v ? COMPRESS_OP_RUN : COMPRESS_OP_ZERO, n);
+        if (v)
+            *out++ = v;
+        avail -= out - begin;
+        pos += n;
+        literal = pos;
+    }
+
+    if (pos > literal) {
+        if (avail < (pos - literal) + COMPRESS_MAX_OP_SIZE)
+            return 0;
+        out = emit_literal(out, src, ref, literal, pos - literal);
+    }
+
+    return out - dst;
+}
+
+int
+gbc_decompress(const uint8_t *src, size_t src_size, const uint8_t *ref, uint8_t *dst, size_t size)
+{
+    const uint8_t *in = src;
+    const uint8_t *in_end = src + src_size;
+    size_t pos = 0;
+
+    while (in < in_end) {
+        uint8_t op = *in & COMPRESS_OP_MASK;
+        size_t len = (*in++ & COMPRESS_LEN_MASK) + 1;
+
+        if (len > COMPRESS_SHORT_LEN) {
+            size_t extra = 0;
+            int shift = 0;
+            do {
+                if (in == in_end || shift > 56)
+                    return 1;
+                extra |= (size_t)(*in & 0x7f) << shift;
+                shift += 7;
+            } while (*in++ & 0x80);
+            len = COMPRESS_SHORT_LEN + 1 + extra;
+        }
+
+        if (len > size - pos)
+            return 1;
+
+        uint8_t *d = dst + pos;
+        const uint8_t *r = ref ? ref + pos : NULL;
+        size_t i = 0;
+
+        switch (op) {
+        case COMPRESS_OP_ZERO:
+            if (!r)
+                memset(d, 0, len);
+            else if (r != d)
+                memcpy(d, r, len);
+            break;
+        case COMPRESS_OP_LITERAL:
+            if ((size_t)(in_end - in) < len)
+                return 1;
+            if (r) {
+                for (; i + 8 <= len; i += 8)
+                    store64(d + i, load64(in + i) ^ load64(r + i));
+                for (; i < len; i++)
+                    d[i] = in[i] ^ r[i];
+            } else {
+                memcpy(d, in, len);
+            }
+            in += len;
+            break;
+        case COMPRESS_OP_RUN:
+            if (in == in_end)
+                return 1;
+            if (r) {
+                uint64_t word = *in * 0x0101010101010101ULL;
+                for (; i + 8 <= len; i += 8)
+                    store64(d + i, load64(r + i) ^ word);
+                for (; i < len; i++)
+                    d[i] = r[i] ^ *in;
+            } else {
+                memset(d, *in, len);
+            }
+            in++;
+            break;
+        default:
+            return 1;
+        }
+        pos += len;
+    }
+
+    return pos == size ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include "common.h"
+
+/*
+Run-length codec for machine snapshots.
+A snapshot is mostly MBC RAM, WRAM and VRAM, either zero filled or unchanged since the previous
+snapshot. With a reference snapshot, the data is XORed against it first so unchanged bytes become
+zeros, then zero runs, byte runs and literals are encoded. Runs are found 8 bytes at a time.
+
+The stream is a list of ops, the 2 top bits of the first byte are the op, the 6 low bits the length:
+
+    0x00 ZERO     len                   len zero bytes(unchanged bytes when delta coding)
+    0x40 LITERAL  len, len bytes
+    0x80 RUN      len, 1 byte           len times the byte
+    0xc0          reserved
+
+A length field of 0-62 is a length of 1-63, 63 means the length is 64 + a varint
+(7 bits per byte, least significant first, the top bit is set when more bytes follow).
+
+There is no header, the caller stores the uncompressed size and which reference was used.
+*/
+
+#define COMPRESS_OP_ZERO    0x00
+#define COMPRESS_OP_LITERAL 0x40
+#define COMPRESS_OP_RUN     0x80
+#define COMPRESS_OP_MASK    0xc0
+#define COMPRESS_LEN_MASK   0x3f
+
+#define COMPRESS_SHORT_LEN  63
+/* shorter runs are cheaper as part of a literal */
+#define COMPRESS_MIN_RUN    4
+/* op byte + the longest varint of a 64 bits length */
+#define COMPRESS_MAX_OP_SIZE 11
+
+/* the worst case compressed size */
+#define COMPRESS_BOUND(size) ((size) + (size) / COMPRESS_SHORT_LEN + COMPRESS_MAX_OP_SIZE * 2)
+
+/*
+ref is NULL or a buffer of the same size to delta against.
+Returns the compressed size, 0 if dst is too small.
+*/
+size_t gbc_compress(const uint8_t *src, const uint8_t *ref, size_t size, uint8_t *dst, size_t dst_size);
+
+/*
+ref must be the buffer given to gbc_compress(), it may be dst itself to apply the delta in place.
+Returns 0 on success, 1 if the data is corrupted or doesn't decompress to exactly size bytes.
+*/
+int gbc_decompress(const uint8_t *src, size_t src_size, const uint8_t *ref, uint8_t *dst, size_t size);
+
+#endif
@@ -1,5 +1,6 @@
 #include "gbc.h"
 #include "instruction_set.h"
+#include "boot.h"
 #include "gui/gui.h"
 
 
@@ -17,6 +18,8 @@ int
 gbc_init(gbc_t *gbc, const char *game_rom, const char *boot_rom)
 {
     init_instruction_set();
+    /* started again, the rewind ring of the last game goes */
+    gbc_rewind_destroy(&gbc->rewind);
     memset(gbc, 0, sizeof(gbc_t));
 
     gbc_mem_init(&gbc->mem);
@@ -26,6 +29,7 @@ gbc_init(gbc_t *gbc, const char *game_rom, const char *boot_rom)
     gbc_io_init(&gbc->io);
     gbc_graphic_init(&gbc->graphic);
     gbc_audio_init(&gbc->audio);
+    gbc_cheat_init(&gbc->cheat);
 
     gbc_cpu_connect(&gbc->cpu, &gbc->mem);
     gbc_mbc_connect(&gbc->mbc, &gbc->mem);
@@ -33,6 +37,7 @@ gbc_init(gbc_t *gbc, const char *game_rom, const char *boot_rom)
     gbc_io_connect(&gbc->io, &gbc->mem);
     gbc_graphic_connect(&gbc->graphic, &gbc->mem);
     gbc_audio_connect(&gbc->audio, &gbc->mem);
+    gbc_cheat_connect(&gbc->cheat, &gbc->mem, &gbc->graphic);
 
     FILE *cartridge = fopen(game_rom, "rb");
 
@@ -55,22 +60,29 @@ gbc_init(gbc_t *gbc, const char *game_rom, const char *boot_rom)
     fclose(cartridge);
 
     cartridge_t *cart = cartridge_load((uint8_t*)data);
-    gbc_mbc_init_with_cart(&gbc->mbc, cart);
-    gbc->mbc.rom_banks = data;
 
     if (!cart) {
         LOG_ERROR("Failed to load cartridge\n");
         return 1;
     }
 
-    WRITE_R16(&gbc->cpu, REG_PC, 0x0100);
+    gbc_mbc_init_with_cart(&gbc->mbc, cart);
+
+    /* the CGB flag picks the mode once, the boot ROM locks it with KEY0 */
+    uint8_t dmg_compat = !(cart->cart_cgb_flag & 0x80);
+    gbc->mem.dmg_compat = dmg_compat;
+    gbc_graphic_set_dmg_compat(&gbc->graphic, dmg_compat);
+    gbc->mbc.rom_banks = data;
 
-    /* initial values https://gbdev.io/pandocs/Power_Up_Sequence.html  */
-    IO_PORT_WRITE(&(gbc->mem), IO_PORT_LCDC, 0x91);
+    gbc_cheat_set_rom(&gbc->cheat, data, n);
+    gbc_cheat_load(&gbc->cheat);
 
     if (boot_rom) {
         gbc_load_boot_rom(gbc, boot_rom);        /* boot rom starts at 0x0000 */
         WRITE_R16(&gbc->cpu, REG_PC, 0x0000);
+    } else {
+        /* no boot rom, synthesise the state it leaves behind and start at 0x0100 */
+        gbc_boot_hle(gbc);
     }
 
     gbc->running = 1;
@@ -91,11 +103,20 @@ gbc_run(gbc_t *gbc)
         if (now - lastf < FRAME_INTERVAL)
             continue;
 
+        /* a frame and a half late, adaptive frame skip kicks in */
+        gbc->graphic.host_late = now - lastf > FRAME_INTERVAL + FRAME_INTERVAL / 2;
         lastf = now;
 
         if (!gbc->running)
             break;
 
+        uint8_t rewinding = gbc->rewind.rewinding && !gbc->paused;
+        if (rewinding && gbc_rewind_pop(&gbc->rewind)) {
+            /* nothing left, stay on the oldest snapshot */
+            gbc->graphic.screen_update(&gbc->graphic);
+            continue;
+        }
+
         int frame_cycles = CYCLES_PER_FRAME;
 
         while (frame_cycles--) {
@@ -118,11 +139,19 @@ gbc_run(gbc_t *gbc)
                 gbc_cpu_cycle(&gbc->cpu);
                 gbc_timer_cycle(&gbc->timer);
             }
-            gbc_graphic_cycle(&gbc->graphic);
+            /* the same as gbc_graphic_cycle(), without a call per cycle */
+            if (gbc->graphic.dots)
+                gbc->graphic.dots--;
+            else
+                gbc_graphic_event(&gbc->graphic);
             gbc_io_cycle(&gbc->io);
             gbc_audio_cycle(&gbc->audio);
         }
 
+        /* while rewinding, the frame only shows the snapshot that was loaded */
+        if (!rewinding && !gbc->paused)
+            gbc_rewind_frame(&gbc->rewind);
+
         gbc->graphic.screen_update(&gbc->graphic);
         gbc->audio.audio_update(&gbc->audio);
     }
@@ -8,6 +8,8 @@
 #include "graphic.h"
 #include "timer.h"
 #include "audio.h"
+#include "cheat.h"
+#include "rewind.h"
 
 typedef struct gbc gbc_t;
 
@@ -19,12 +21,18 @@ struct gbc {
     gbc_graphic_t graphic;
     gbc_timer_t timer;
     gbc_audio_t audio;
+    gbc_cheat_t cheat;
+    gbc_rewind_t rewind;
 
     uint32_t debug_steps;
     volatile uint8_t running:1;
     volatile uint8_t paused:1;
 };
 
+/*
+gbc must be zeroed before the first call, e.g. static, it can be called again for another game.
+Rewind is off, the frontend turns it on with gbc_rewind_init() and the memory it can spare.
+*/
 int gbc_init(gbc_t *gbc, const char *game_rom, const char *boot_rom);
 void gbc_run(gbc_t *gbc);
 
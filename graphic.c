@@ -4,11 +4,18 @@
 
 static void* vram_addr(void *udata, uint16_t addr);
 static void* vram_addr_bank(void *udata, uint16_t addr, uint8_t bank);
+static void gbc_graphic_draw_line(gbc_graphic_t *graphic, const gbc_line_regs_t *regs);
 
 void
 gbc_graphic_init(gbc_graphic_t *graphic)
 {
     memset(graphic, 0, sizeof(gbc_graphic_t));
+    graphic->simd = gbc_simd_select();
+    graphic->blend_format = PIXEL_FORMATS;
+    graphic->front_format = PIXEL_FORMATS;
+    graphic->draw_line = gbc_graphic_draw_line;
+    graphic->draw_vram = graphic->vram;
+    gbc_graphic_invalidate_tiles(graphic);
 }
 
 gbc_tile_t*
@@ -58,222 +65,1187 @@ gbc_graphic_get_tilemap(gbc_graphic_t *graphic, uint8_t type)
     return (gbc_tilemap_t*)vram_addr_bank(graphic, addr, 0);
 }
 
-inline static uint16_t
-gbc_graphic_render_pixel(gbc_graphic_t *graphic, uint16_t scanline, uint16_t col, uint8_t *objs_idx, uint8_t objs_count)
+/*
+A scanline is drawn in layers: BG, window, objs, then they are composed.
+BG and window are drawn a tile(8 pixels) at a time, objs are drawn into their own line buffer.
+The registers are read once, when the line is drawn, PPU_ACCURACY_DOT reads them again after mid-line writes.
+*/
+typedef struct gbc_graphic_line gbc_graphic_line_t;
+
+struct gbc_graphic_line
 {
-    uint8_t lcdc = IO_PORT_READ(graphic->mem, IO_PORT_LCDC);
-    uint16_t bg_color, obj_color;
-    uint16_t tile_x, tile_y, x, y, tile_x_offset, tile_y_offset;
-    uint8_t attr, bg_color_id;
+    gbc_line_regs_t regs;
+    gbc_simd_line_t layers;
+};
 
-    gbc_palette_t *palette;
-    gbc_tile_t *tile;
-    uint8_t bgwin_priority = 0;
-    uint8_t lcdc_bit0 = lcdc & LCDC_BG_ENABLE;
+static void
+tile_cache_decode(gbc_graphic_t *graphic, uint16_t tile)
+{
+    gbc_tile_cache_t *cache = &graphic->tile_cache;
+    uint8_t bank = tile / TILES_PER_BANK;
+    uint8_t *data = graphic->draw_vram + bank * VRAM_BANK_SIZE + (tile % TILES_PER_BANK) * TILE_BYTES;
 
-    bg_color = obj_color = 0;
-    bg_color_id = 0;
+    graphic->simd->tile_decode(data, cache->pixels[tile][0], cache->pixels[tile][1]);
+    cache->dirty[tile] = 0;
+}
 
-    if (lcdc_bit0) {
-        /* background */
-        /* TODO:
-        "The scroll registers are re-read on each tile fetch, except for the low 3 bits of SCX" Does it matter?
-        https://gbdev.io/pandocs/Scrolling.html#mid-frame-behavior
-        */
-        uint16_t scroll_x = IO_PORT_READ(graphic->mem, IO_PORT_SCX);
-        uint16_t scroll_y = IO_PORT_READ(graphic->mem, IO_PORT_SCY);
-        gbc_tilemap_t *bg_tilemap = gbc_graphic_get_tilemap(graphic, TILE_TYPE_BG);
-        gbc_tilemap_attr_t *bg_tilemap_attr = gbc_graphic_get_tilemap_attr(graphic, TILE_TYPE_BG);
+const uint8_t*
+gbc_graphic_tile_pixels(gbc_graphic_t *graphic, uint16_t tile, uint8_t xflip)
+{
+    if (graphic->tile_cache.dirty[tile])
+        tile_cache_decode(graphic, tile);
+    return graphic->tile_cache.pixels[tile][xflip ? 1 : 0];
+}
 
-        x = (scroll_x + col) % TILE_MAP_SIZE;
-        y = (scroll_y + scanline) % TILE_MAP_SIZE;
+void
+gbc_graphic_invalidate_tiles(gbc_graphic_t *graphic)
+{
+    /* the worker may be using them */
+    gbc_graphic_sync(graphic);
+    memset(graphic->tile_cache.dirty, 1, sizeof(graphic->tile_cache.dirty));
+    if (graphic->layers) {
+        memset(graphic->layers->map[0].dirty, 1, sizeof(graphic->layers->map[0].dirty));
+        memset(graphic->layers->map[1].dirty, 1, sizeof(graphic->layers->map[1].dirty));
+    }
+}
 
-        tile_x = x / TILE_SIZE;
-        tile_y = y / TILE_SIZE;
+/* the tile cache index of a tilemap/OAM tile index, objs always use 0x8000 */
+static inline uint16_t
+tile_cache_idx(uint8_t type, uint8_t lcdc, uint8_t idx, uint8_t bank)
+{
+    uint16_t tile = idx;
+    if (type != TILE_TYPE_OBJ && !(lcdc & LCDC_BG_WINDOW_TILE_DATA))
+        tile = 0x100 + (int8_t)idx;    /* 0x9000 based */
+    return bank * TILES_PER_BANK + tile;
+}
 
-        tile_x_offset = x % TILE_SIZE;
-        tile_y_offset = y % TILE_SIZE;
+static inline uint8_t*
+tilemap_row(gbc_graphic_t *graphic, uint8_t lcdc, uint8_t map_bit, uint8_t tile_y)
+{
+    uint16_t addr = lcdc & map_bit ? 0x9C00 : 0x9800;
+    /* the attributes are at the same place in bank 1 */
+    return graphic->draw_vram + addr - VRAM_BEGIN + tile_y * 32;
+}
 
-        attr = bg_tilemap_attr->data[tile_y][tile_x];
-        tile = gbc_graphic_get_tile(graphic, TILE_TYPE_BG, bg_tilemap->data[tile_y][tile_x],
-                TILE_ATTR_VRAM_BANK(attr) ? 1 : 0);
+/* draws tilemap tiles from col to the end of the line, x is the position in the first tile */
+typedef void (*draw_tiles_fn)(gbc_graphic_t *graphic, gbc_graphic_line_t *line, uint8_t *map, uint8_t tile_x,
+    uint8_t x, uint8_t y, int col);
 
-        if (TILE_ATTR_XFLIP(attr)) {
-            tile_x_offset = TILE_SIZE - tile_x_offset - 1;
+static void
+draw_tiles(gbc_graphic_t *graphic, gbc_graphic_line_t *line, uint8_t *map, uint8_t tile_x, uint8_t x, uint8_t y, int col)
+{
+    while (col < VISIBLE_HORIZONTAL_PIXELS) {
+        uint8_t idx = map[tile_x % 32];
+        uint8_t attr = map[VRAM_BANK_SIZE + tile_x % 32];
+        uint8_t row = TILE_ATTR_YFLIP(attr) ? TILE_SIZE - 1 - y : y;
+        uint8_t priority = TILE_ATTR_PRIORITY(attr) ? 1 : 0;
+        uint8_t palette = HOST_PALETTE_BG(TILE_ATTR_PALETTE(attr), 0);
+
+        const uint8_t *color_ids = gbc_graphic_tile_pixels(graphic,
+            tile_cache_idx(TILE_TYPE_BG, line->regs.lcdc, idx, TILE_ATTR_VRAM_BANK(attr) ? 1 : 0),
+            TILE_ATTR_XFLIP(attr)) + row * TILE_SIZE;
+
+        int n = TILE_SIZE - x;
+        if (n > VISIBLE_HORIZONTAL_PIXELS - col)
+            n = VISIBLE_HORIZONTAL_PIXELS - col;
+
+        for (int i = 0; i < n; i++) {
+            uint8_t color_id = color_ids[x + i];
+            line->layers.bg_color_id[col + i] = color_id;
+            line->layers.bg_color[col + i] = palette + color_id;
+            /* a window pixel keeps the priority bit of the BG pixel below it */
+            line->layers.bg_priority[col + i] |= priority;
         }
-        if (TILE_ATTR_YFLIP(attr)) {
-            tile_y_offset = TILE_SIZE - tile_y_offset - 1;
+        col += n;
+        x = 0;
+        tile_x++;
+    }
+}
+
+/*
+DMG compatibility mode: no attributes, every tile is in bank 0 and uses BG palette 0 through BGP.
+https://gbdev.io/pandocs/Palettes.html#ff47--bgp-non-cgb-mode-only-bg-palette-data
+*/
+static void
+draw_tiles_dmg(gbc_graphic_t *graphic, gbc_graphic_line_t *line, uint8_t *map, uint8_t tile_x, uint8_t x, uint8_t y, int col)
+{
+    uint8_t bgp = line->regs.bgp;
+    uint8_t colors[4] = {
+        HOST_PALETTE_BG(0, bgp & 0x03), HOST_PALETTE_BG(0, (bgp >> 2) & 0x03),
+        HOST_PALETTE_BG(0, (bgp >> 4) & 0x03), HOST_PALETTE_BG(0, (bgp >> 6) & 0x03),
+    };
+
+    while (col < VISIBLE_HORIZONTAL_PIXELS) {
+        const uint8_t *color_ids = gbc_graphic_tile_pixels(graphic,
+            tile_cache_idx(TILE_TYPE_BG, line->regs.lcdc, map[tile_x % 32], 0), 0) + y * TILE_SIZE;
+
+        int n = TILE_SIZE - x;
+        if (n > VISIBLE_HORIZONTAL_PIXELS - col)
+            n = VISIBLE_HORIZONTAL_PIXELS - col;
+
+        for (int i = 0; i < n; i++) {
+            uint8_t color_id = color_ids[x + i];
+            line->layers.bg_color_id[col + i] = color_id;
+            line->layers.bg_color[col + i] = colors[color_id];
         }
+        col += n;
+        x = 0;
+        tile_x++;
+    }
+}
 
-        bg_color_id = TILE_PIXEL_COLORID(tile, tile_x_offset, tile_y_offset);
-        palette = BG_PALETTE_READ(graphic->mem, TILE_ATTR_PALETTE(attr));
+static void
+layer_cell_draw(gbc_graphic_t *graphic, gbc_layer_t *layer, const uint8_t *map, int cell)
+{
+    uint8_t attr = map[VRAM_BANK_SIZE + cell];
+    uint16_t tile = tile_cache_idx(TILE_TYPE_BG, layer->tile_data, map[cell], TILE_ATTR_VRAM_BANK(attr) ? 1 : 0);
+    const uint8_t *color_ids = gbc_graphic_tile_pixels(graphic, tile, TILE_ATTR_XFLIP(attr));
+    uint8_t palette = HOST_PALETTE_BG(TILE_ATTR_PALETTE(attr), 0);
+    uint8_t priority = TILE_ATTR_PRIORITY(attr) ? 1 : 0;
+    int x = cell % 32 * TILE_SIZE, y = cell / 32 * TILE_SIZE;
+
+    for (int row = 0; row < TILE_SIZE; row++) {
+        const uint8_t *src = color_ids + (TILE_ATTR_YFLIP(attr) ? TILE_SIZE - 1 - row : row) * TILE_SIZE;
+        for (int i = 0; i < TILE_SIZE; i++) {
+            layer->color_id[y + row][x + i] = src[i];
+            layer->color[y + row][x + i] = palette + src[i];
+        }
+        memset(&layer->priority[y + row][x], priority, TILE_SIZE);
+    }
 
-        bg_color = palette->c[bg_color_id];
+    layer->tile[cell] = tile;
+    layer->priority_cell[cell] = priority;
+    layer->generation[cell] = graphic->layers->tile_generation[tile];
+    layer->dirty[cell] = 0;
+}
 
-        /* https://gbdev.io/pandocs/Tile_Maps.html#bg-to-obj-priority-in-cgb-mode */
-        if (TILE_ATTR_PRIORITY(attr))
-            bgwin_priority |= 1;
+/* draw_tiles() from the layer cache, the cells the line goes through are drawn first if they changed */
+static void
+draw_tiles_layer(gbc_graphic_t *graphic, gbc_graphic_line_t *line, uint8_t *map, uint8_t tile_x, uint8_t x, uint8_t y, int col)
+{
+    gbc_layer_cache_t *layers = graphic->layers;
+    int offset = map - (graphic->draw_vram + TILEMAP_BEGIN - VRAM_BEGIN);
+    gbc_layer_t *layer = &layers->map[offset / TILEMAP_BYTES];
+    uint8_t tile_y = offset % TILEMAP_BYTES / 32;
+    uint8_t tile_data = line->regs.lcdc & LCDC_BG_WINDOW_TILE_DATA;
+
+    map -= tile_y * 32;
+    if (layer->tile_data != tile_data) {
+        layer->tile_data = tile_data;
+        memset(layer->dirty, 1, sizeof(layer->dirty));
     }
 
-    /* window */
-    if (lcdc & LCDC_WINDOW_ENABLE) {
-        /* TODO:
-        we doesn't wait until WY and WX conditions are met
-        https://gbdev.io/pandocs/Scrolling.html#window */
+    int n = VISIBLE_HORIZONTAL_PIXELS - col;
+    uint8_t priority = 0;
+    for (int i = 0; i < (x + n + TILE_SIZE - 1) / TILE_SIZE; i++) {
+        int cell = tile_y * 32 + (tile_x + i) % 32;
+        if (layer->dirty[cell] || layer->generation[cell] != layers->tile_generation[layer->tile[cell]])
+            layer_cell_draw(graphic, layer, map, cell);
+        priority |= layer->priority_cell[cell];
+    }
+
+    /* the map wraps around at the right edge */
+    uint8_t row = tile_y * TILE_SIZE + y;
+    uint8_t from = tile_x % 32 * TILE_SIZE + x;
+    int first = n < TILE_MAP_SIZE - from ? n : TILE_MAP_SIZE - from;
+
+    memcpy(line->layers.bg_color_id + col, &layer->color_id[row][from], first);
+    memcpy(line->layers.bg_color_id + col + first, layer->color_id[row], n - first);
+    memcpy(line->layers.bg_color + col, &layer->color[row][from], first);
+    memcpy(line->layers.bg_color + col + first, layer->color[row], n - first);
+    if (!priority)
+        return;
+    /* a window pixel keeps the priority bit of the BG pixel below it */
+    for (int i = 0; i < first; i++)
+        line->layers.bg_priority[col + i] |= layer->priority[row][from + i];
+    for (int i = first; i < n; i++)
+        line->layers.bg_priority[col + i] |= layer->priority[row][i - first];
+}
+
+static inline void
+draw_line_bg(gbc_graphic_t *graphic, gbc_graphic_line_t *line, draw_tiles_fn draw_tiles)
+{
+    /*
+    "The scroll registers are re-read on each tile fetch, except for the low 3 bits of SCX"
+    https://gbdev.io/pandocs/Scrolling.html#mid-frame-behavior
+    Only PPU_ACCURACY_DOT re-reads them, when they are written during mode 3.
+    */
+    uint8_t scroll_x = line->regs.scx;
+    uint8_t y = line->regs.scy + line->regs.scanline;
+    uint8_t *map = tilemap_row(graphic, line->regs.lcdc, LCDC_BG_TILE_MAP, y / TILE_SIZE);
+
+    draw_tiles(graphic, line, map, scroll_x / TILE_SIZE, scroll_x % TILE_SIZE, y % TILE_SIZE, 0);
+}
 
-        uint8_t window_x = IO_PORT_READ(graphic->mem, IO_PORT_WX) - 7;
-        uint8_t window_y = IO_PORT_READ(graphic->mem, IO_PORT_WY);
+static inline void
+draw_line_window(gbc_graphic_t *graphic, gbc_graphic_line_t *line, draw_tiles_fn draw_tiles)
+{
+    /* https://gbdev.io/pandocs/Scrolling.html#window */
+    uint8_t window_x = line->regs.wx - 7;
 
-        /* notice that window_x and window_y are always positive */
-        if (scanline >= window_y && col >= window_x) {
-            gbc_tilemap_t *win_tilemap = gbc_graphic_get_tilemap(graphic, TILE_TYPE_WIN);
-            gbc_tilemap_attr_t *win_tilemap_attr = gbc_graphic_get_tilemap_attr(graphic, TILE_TYPE_WIN);
+    /* window_x wraps around when WX < 7, the window is not shown then */
+    if (line->regs.window_line == WINDOW_LINE_NONE || window_x >= VISIBLE_HORIZONTAL_PIXELS)
+        return;
 
-            x = col - window_x;
-            y = scanline - window_y;
+    uint8_t y = line->regs.window_line;
+    uint8_t *map = tilemap_row(graphic, line->regs.lcdc, LCDC_WINDOW_TILE_MAP, y / TILE_SIZE);
 
-            tile_x = x / TILE_SIZE;
-            tile_y = y / TILE_SIZE;
+    draw_tiles(graphic, line, map, 0, 0, y % TILE_SIZE, window_x);
+}
 
-            tile_x_offset = x % TILE_SIZE;
-            tile_y_offset = y % TILE_SIZE;
+/* colors maps the color ids of the obj to host palette indexes */
+static inline void
+draw_obj(gbc_graphic_t *graphic, gbc_graphic_line_t *line, const gbc_obj_t *obj, const uint8_t *colors, uint8_t bank)
+{
+    uint8_t obj_y = OAM_Y_TO_SCREEN(obj->y);
+    uint8_t obj_x = OAM_X_TO_SCREEN(obj->x);
+    uint8_t tile_idx = obj->tile;
+    uint8_t tile_y_offset = line->regs.scanline - obj_y;
+    uint8_t attr = obj->attr;
+
+    if (line->regs.lcdc & LCDC_OBJ_SIZE) {
+        /* 8x16 */
+        if (tile_y_offset >= OBJ_HEIGHT) {
+            /* bottom tile */
+            tile_y_offset -= TILE_SIZE;
+            tile_idx = OBJ_ATTR_YFLIP(attr) ? (tile_idx & 0xFE) : (tile_idx | 0x01);
+        } else {
+            /* top tile */
+            tile_idx = OBJ_ATTR_YFLIP(attr) ? (tile_idx | 0x01) : (tile_idx & 0xFE);
+        }
+    }
 
-            attr = win_tilemap_attr->data[tile_y][tile_x];
-            tile = gbc_graphic_get_tile(graphic, TILE_TYPE_WIN, win_tilemap->data[tile_y][tile_x],
-                    TILE_ATTR_VRAM_BANK(attr) ? 1 : 0);
+    if (OBJ_ATTR_YFLIP(attr))
+        tile_y_offset = TILE_SIZE - tile_y_offset - 1;
 
-            if (TILE_ATTR_XFLIP(attr)) {
-                tile_x_offset = TILE_SIZE - tile_x_offset - 1;
-            }
+    const uint8_t *color_ids = gbc_graphic_tile_pixels(graphic,
+        tile_cache_idx(TILE_TYPE_OBJ, line->regs.lcdc, tile_idx, bank),
+        OBJ_ATTR_XFLIP(attr)) + tile_y_offset * TILE_SIZE;
 
-            if (TILE_ATTR_YFLIP(attr)) {
-                tile_y_offset = TILE_SIZE - tile_y_offset - 1;
-            }
+    uint8_t priority = OBJ_ATTR_BG_PRIORITY(attr) ? 1 : 0;
 
-            bg_color_id = TILE_PIXEL_COLORID(tile, tile_x_offset, tile_y_offset);
-            palette = BG_PALETTE_READ(graphic->mem, TILE_ATTR_PALETTE(attr));
+    /* obj_x wraps around when X < 8, the obj is not shown then */
+    for (int x = 0, col = obj_x; x < TILE_SIZE && col < VISIBLE_HORIZONTAL_PIXELS; x++, col++) {
+        /*
+        color 0 means transparent,
+        the obj drawn first has higher priority, the callers draw them in priority order
+        */
+        if (color_ids[x] == 0 || line->layers.obj_color_id[col])
+            continue;
+        line->layers.obj_color_id[col] = color_ids[x];
+        line->layers.obj_color[col] = colors[color_ids[x]];
+        line->layers.obj_priority[col] = priority;
+    }
+}
 
-            /* window has higher priority than background */
-            bg_color = palette->c[bg_color_id];
+static void
+draw_line_objs(gbc_graphic_t *graphic, gbc_graphic_line_t *line, uint8_t *objs_idx, uint8_t objs_count)
+{
+    gbc_obj_t *objs = (gbc_obj_t*)graphic->draw_oam;
+
+    /* in OAM order, the earlier obj has higher priority */
+    for (int i = 0; i < objs_count; i++) {
+        gbc_obj_t *obj = objs + objs_idx[i];
+        uint8_t palette = HOST_PALETTE_OBJ(OBJ_ATTR_PALETTE(obj->attr), 0);
+        uint8_t colors[4] = {palette, palette + 1, palette + 2, palette + 3};
+        draw_obj(graphic, line, obj, colors, OBJ_ATTR_VRAM_BANK(obj->attr) ? 1 : 0);
+    }
+}
 
-            if (TILE_ATTR_PRIORITY(attr))
-                bgwin_priority |= 1;
+/*
+DMG compatibility mode, the obj with the smaller X has higher priority, then the earlier in OAM.
+The colors go through OBP0 or OBP1 to OBJ palette 0 or 1, every tile is in bank 0.
+https://gbdev.io/pandocs/OAM.html#drawing-priority
+*/
+static void
+draw_line_objs_dmg(gbc_graphic_t *graphic, gbc_graphic_line_t *line, uint8_t *objs_idx, uint8_t objs_count)
+{
+    gbc_obj_t *objs = (gbc_obj_t*)graphic->draw_oam;
+    uint8_t obp[2] = {line->regs.obp0, line->regs.obp1};
+    uint8_t order[MAX_OBJ_SCANLINE];
+
+    for (int i = 0; i < objs_count; i++) {
+        int j = i;
+        for (; j > 0 && objs[order[j - 1]].x > objs[objs_idx[i]].x; j--)
+            order[j] = order[j - 1];
+        order[j] = objs_idx[i];
+    }
+
+    for (int i = 0; i < objs_count; i++) {
+        gbc_obj_t *obj = objs + order[i];
+        uint8_t palette = OBJ_ATTR_DMG_PALETTE(obj->attr) ? 1 : 0;
+        uint8_t colors[4];
+        for (int c = 0; c < 4; c++)
+            colors[c] = HOST_PALETTE_OBJ(palette, (obp[palette] >> (c * 2)) & 0x03);
+        draw_obj(graphic, line, obj, colors, 0);
+    }
+}
+
+static gbc_obj_index_t*
+obj_index_get(gbc_graphic_t *graphic, uint8_t obj_size)
+{
+    gbc_obj_index_t *index = &graphic->obj_index;
+    if (!*graphic->draw_oam_dirty && index->obj_size == obj_size)
+        return index;
+
+    uint8_t obj_height = obj_size ? OBJ_HEIGHT_2 : OBJ_HEIGHT;
+    gbc_obj_t *obj = (gbc_obj_t*)graphic->draw_oam;
+
+    memset(index->count, 0, sizeof(index->count));
+    for (int i = 0; i < MAX_OBJS; i++, obj++) {
+        uint8_t y = OAM_Y_TO_SCREEN(obj->y);
+        /* y wraps around when Y < 16, the obj is not shown then */
+        for (int line = y; line < y + obj_height && line < VISIBLE_VERTICAL_PIXELS; line++) {
+            if (index->count[line] < MAX_OBJ_SCANLINE)
+                index->objs[line][index->count[line]++] = i;
         }
     }
 
-    if (lcdc_bit0 && bg_color_id && bgwin_priority) {
-        return bg_color;
+    index->obj_size = obj_size;
+    *graphic->draw_oam_dirty = 0;
+    return index;
+}
+
+/* not a checksum, only to see if a line changed */
+static inline uint64_t
+line_hash(const uint8_t *pixels, uint16_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (int i = 0; i < size; i += 8) {
+        uint64_t v;
+        memcpy(&v, pixels + i, sizeof(v));
+        hash = (hash ^ v) * 0x100000001b3;
+        hash ^= hash >> 29;
     }
+    return hash;
+}
+
+/* a row of the back buffer, in mem->pixel_format */
+static inline uint8_t*
+back_line(gbc_graphic_t *graphic, uint8_t scanline)
+{
+    return (uint8_t*)graphic->framebuffer[graphic->front ^ 1] + scanline * FRAMEBUFFER_STRIDE(graphic->mem->pixel_format);
+}
+
+/* what a scanline depends on besides VRAM, OAM and the palettes, read when mode 3 starts */
+static inline void
+line_regs_read(gbc_graphic_t *graphic, uint8_t scanline, gbc_line_regs_t *regs)
+{
+    regs->scanline = scanline;
+    regs->lcdc = IO_PORT_READ(graphic->mem, IO_PORT_LCDC);
+    regs->scx = IO_PORT_READ(graphic->mem, IO_PORT_SCX);
+    regs->scy = IO_PORT_READ(graphic->mem, IO_PORT_SCY);
+    regs->wx = IO_PORT_READ(graphic->mem, IO_PORT_WX);
+    regs->wy = IO_PORT_READ(graphic->mem, IO_PORT_WY);
+    regs->bgp = IO_PORT_READ(graphic->mem, IO_PORT_BGP);
+    regs->obp0 = IO_PORT_READ(graphic->mem, IO_PORT_OBP0);
+    regs->obp1 = IO_PORT_READ(graphic->mem, IO_PORT_OBP1);
+    regs->window_line = scanline >= regs->wy ? scanline - regs->wy : WINDOW_LINE_NONE;
+    regs->x_from = 0;
+    regs->x_to = VISIBLE_HORIZONTAL_PIXELS;
+}
 
-    uint8_t obj_found = 0;
+/* host palette indexes to pixels [from, to) of the back buffer, the line is done when to is its end */
+static void
+line_output(gbc_graphic_t *graphic, uint8_t scanline, const uint8_t *colors, uint8_t from, uint8_t to)
+{
+    uint8_t format = graphic->mem->pixel_format;
+    uint8_t bytes = PIXEL_FORMAT_BYTES(format);
+    uint8_t *pixels = back_line(graphic, scanline);
 
-    /* objs */
-    if (lcdc & LCDC_OBJ_ENABLE) {
-        for (int i = 0; i < objs_count; i++) {
-            gbc_obj_t *obj = (gbc_obj_t*)OAM_ADDR(graphic->mem);
-            obj += objs_idx[i];
+    graphic->simd->palette_lookup(graphic->draw_palette, colors + from, pixels + from * bytes, to - from, bytes);
+    if (to < VISIBLE_HORIZONTAL_PIXELS)
+        return;
 
-            uint8_t obj_y = OAM_Y_TO_SCREEN(obj->y);
-            uint8_t obj_x = OAM_X_TO_SCREEN(obj->x);
+    graphic->line_hash[scanline] = line_hash(pixels, FRAMEBUFFER_STRIDE(format));
+    graphic->lines_drawn[scanline / 32] |= 1u << (scanline % 32);
 
-            if (col < obj_x || col >= obj_x + OBJ_WIDTH) {
-                continue;
-            }
+    if (graphic->line_ready)
+        graphic->line_ready(graphic->screen_udata, scanline, pixels);
+}
 
-            uint8_t tile_idx = obj->tile;
-            uint8_t tile_x_offset = col - obj_x;
-            uint8_t tile_y_offset = scanline - obj_y;
+static void
+gbc_graphic_draw_line(gbc_graphic_t *graphic, const gbc_line_regs_t *regs)
+{
+    uint8_t scanline = regs->scanline;
+    uint8_t lcdc = regs->lcdc;
+    gbc_graphic_line_t line;
 
-            if (lcdc & LCDC_OBJ_SIZE) {
-                /* 8x16 */
-                if (scanline >= obj_y + OBJ_HEIGHT) {
-                    /* bottom tile */
-                    tile_y_offset -= TILE_SIZE;
-                    tile_idx = OBJ_ATTR_YFLIP(obj->attr) ? (tile_idx & 0xFE) : (tile_idx | 0x01);
-                } else {
-                    /* top tile */
-                    tile_idx = OBJ_ATTR_YFLIP(obj->attr) ? (tile_idx | 0x01) : (tile_idx & 0xFE);
-                }
-            }
+    gbc_obj_index_t *index = obj_index_get(graphic, lcdc & LCDC_OBJ_SIZE);
 
-            uint8_t attr = obj->attr;
-            gbc_tile_t *tile = gbc_graphic_get_tile(graphic, TILE_TYPE_OBJ, tile_idx,
-                OBJ_ATTR_VRAM_BANK(attr) ? 1 : 0);
+    line.regs = *regs;
+    memset(line.layers.bg_color_id, 0, sizeof(line.layers.bg_color_id));
+    memset(line.layers.bg_priority, 0, sizeof(line.layers.bg_priority));
+    memset(line.layers.bg_color, HOST_PALETTE_BLANK, sizeof(line.layers.bg_color));
+    memset(line.layers.obj_color_id, 0, sizeof(line.layers.obj_color_id));
 
-            if (OBJ_ATTR_XFLIP(attr)) {
-                tile_x_offset = TILE_SIZE - tile_x_offset - 1;
-            }
+    uint8_t lcdc_bit0 = lcdc & LCDC_BG_ENABLE;
+    draw_tiles_fn tiles = graphic->layers ? draw_tiles_layer : draw_tiles;
+    /* the window doesn't care about LCDC.0 */
+    if (lcdc_bit0)
+        draw_line_bg(graphic, &line, tiles);
+    if (lcdc & LCDC_WINDOW_ENABLE)
+        draw_line_window(graphic, &line, tiles);
+    if (lcdc & LCDC_OBJ_ENABLE)
+        draw_line_objs(graphic, &line, index->objs[scanline], index->count[scanline]);
+
+    uint8_t colors[VISIBLE_HORIZONTAL_PIXELS];
+    graphic->simd->line_compose(&line.layers, lcdc_bit0, colors);
+    line_output(graphic, scanline, colors, regs->x_from, regs->x_to);
+}
 
-            if (OBJ_ATTR_YFLIP(attr)) {
-                tile_y_offset = TILE_SIZE - tile_y_offset - 1;
-            }
+/* gbc_graphic_draw_line() for DMG games, LCDC.0 turns BG and window off, they are white then */
+static void
+gbc_graphic_draw_line_dmg(gbc_graphic_t *graphic, const gbc_line_regs_t *regs)
+{
+    uint8_t scanline = regs->scanline;
+    uint8_t lcdc = regs->lcdc;
+    gbc_graphic_line_t line;
 
-            assert(tile_x_offset >= 0 && tile_x_offset < TILE_SIZE);
+    gbc_obj_index_t *index = obj_index_get(graphic, lcdc & LCDC_OBJ_SIZE);
 
-            uint16_t color_id = TILE_PIXEL_COLORID(tile, tile_x_offset, tile_y_offset);
+    line.regs = *regs;
+    memset(line.layers.bg_color_id, 0, sizeof(line.layers.bg_color_id));
+    memset(line.layers.bg_priority, 0, sizeof(line.layers.bg_priority));
+    memset(line.layers.bg_color, HOST_PALETTE_BG(0, 0), sizeof(line.layers.bg_color));
+    memset(line.layers.obj_color_id, 0, sizeof(line.layers.obj_color_id));
 
-            if (color_id == 0) {
-                /* color 0 means transparent */
-                continue;
-            }
+    uint8_t lcdc_bit0 = lcdc & LCDC_BG_ENABLE;
+    if (lcdc_bit0) {
+        draw_line_bg(graphic, &line, draw_tiles_dmg);
+        if (lcdc & LCDC_WINDOW_ENABLE)
+            draw_line_window(graphic, &line, draw_tiles_dmg);
+    }
+    if (lcdc & LCDC_OBJ_ENABLE)
+        draw_line_objs_dmg(graphic, &line, index->objs[scanline], index->count[scanline]);
+
+    uint8_t colors[VISIBLE_HORIZONTAL_PIXELS];
+    graphic->simd->line_compose(&line.layers, lcdc_bit0, colors);
+    line_output(graphic, scanline, colors, regs->x_from, regs->x_to);
+}
+
+/* what a VRAM byte is drawn through, offset is from the start of bank 0 */
+static void
+vram_changed(gbc_graphic_t *graphic, uint16_t offset)
+{
+    uint16_t addr = VRAM_BEGIN + offset % VRAM_BANK_SIZE;
+
+    if (addr <= TILE_DATA_END) {
+        uint16_t tile = offset / VRAM_BANK_SIZE * TILES_PER_BANK + (addr - VRAM_BEGIN) / TILE_BYTES;
+        graphic->tile_cache.dirty[tile] = 1;
+        if (graphic->layers)
+            graphic->layers->tile_generation[tile]++;
+    } else if (graphic->layers) {
+        /* a tilemap entry in bank 0, its attributes in bank 1 */
+        graphic->layers->map[(addr - TILEMAP_BEGIN) / TILEMAP_BYTES].dirty[(addr - TILEMAP_BEGIN) % TILEMAP_BYTES] = 1;
+    }
+}
 
-            gbc_palette_t *palette = OBJ_PALETTE_READ(graphic->mem, OBJ_ATTR_PALETTE(attr));
-            obj_color = palette->c[color_id];
-            if (OBJ_ATTR_BG_PRIORITY(attr))
-                bgwin_priority |= 1;
-            /*
-            the earlier(mem position in OAM) obj has higher priority
-            and gameboy doest have alpha channel, we can break here
-            */
-            obj_found = 1;
+/* brings the snapshot to the version of a line, only the thread drawing the lines calls it */
+static void
+snapshot_replay(gbc_graphic_t *graphic, uint32_t version)
+{
+    gbc_graphic_snapshot_t *snapshot = graphic->worker.snapshot;
+
+    for (uint32_t i = graphic->worker.write_tail; i != version; i++) {
+        const gbc_graphic_write_t *write = &snapshot->writes[i % WORKER_QUEUE_WRITES];
+        switch (write->target) {
+        case RENDER_WRITE_VRAM:
+            snapshot->vram[write->addr] = write->data;
+            vram_changed(graphic, write->addr);
+            break;
+        case RENDER_WRITE_OAM:
+            snapshot->oam[write->addr] = write->data;
+            snapshot->oam_dirty = 1;
+            break;
+        default:
+            snapshot->host_palette[write->addr] = write->data;
             break;
         }
     }
+}
+
+/*
+The worker is idle and nothing was logged since the live state changed behind the log,
+the snapshot catches up by comparing, only the tiles and tilemap cells that changed are drawn again.
+*/
+static void
+snapshot_refresh(gbc_graphic_t *graphic)
+{
+    gbc_graphic_worker_t *worker = &graphic->worker;
+    gbc_graphic_snapshot_t *snapshot = worker->snapshot;
+    gbc_memory_t *mem = graphic->mem;
+
+    for (uint16_t offset = 0; offset < sizeof(snapshot->vram); offset += TILE_BYTES) {
+        if (!memcmp(snapshot->vram + offset, graphic->vram + offset, TILE_BYTES))
+            continue;
+        for (uint16_t i = offset; i < offset + TILE_BYTES; i++) {
+            if (snapshot->vram[i] != graphic->vram[i])
+                vram_changed(graphic, i);
+        }
+        memcpy(snapshot->vram + offset, graphic->vram + offset, TILE_BYTES);
+    }
+    if (memcmp(snapshot->oam, mem->oam, sizeof(snapshot->oam))) {
+        memcpy(snapshot->oam, mem->oam, sizeof(snapshot->oam));
+        snapshot->oam_dirty = 1;
+    }
+    memcpy(snapshot->host_palette, mem->host_palette, sizeof(snapshot->host_palette));
+
+    worker->write_tail = worker->write_seen = worker->write_head;
+    worker->snapshot_stale = 0;
+}
+
+/*
+The worker draws the queued lines in order, from its snapshot. The emulation thread only waits
+for it before a frame is handed over, and when the queue or the log is full.
+*/
+static void*
+worker_main(void *udata)
+{
+    gbc_graphic_t *graphic = (gbc_graphic_t*)udata;
+    gbc_graphic_worker_t *worker = &graphic->worker;
+
+    pthread_mutex_lock(&worker->lock);
+    for (;;) {
+        while (worker->head == worker->tail && !worker->stop)
+            pthread_cond_wait(&worker->work, &worker->lock);
+        if (worker->head == worker->tail)
+            break;
+
+        gbc_line_regs_t regs = worker->lines[worker->tail % WORKER_QUEUE_LINES];
+        uint32_t version = worker->line_writes[worker->tail % WORKER_QUEUE_LINES];
+        pthread_mutex_unlock(&worker->lock);
+        snapshot_replay(graphic, version);
+        graphic->draw_line(graphic, &regs);
+        pthread_mutex_lock(&worker->lock);
+
+        worker->write_tail = version;
+        if (++worker->tail == worker->head)
+            pthread_cond_signal(&worker->idle);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+static void
+line_queue(gbc_graphic_t *graphic, const gbc_line_regs_t *regs)
+{
+    gbc_graphic_worker_t *worker = &graphic->worker;
 
-    if (obj_found && (!bgwin_priority || !bg_color_id || !lcdc_bit0)) {
-        return obj_color;
+    /* the pieces of lines of PPU_ACCURACY_DOT can outnumber the lines of a frame */
+    if (worker->head - worker->drained >= WORKER_QUEUE_LINES)
+        gbc_graphic_sync(graphic);
+
+    if (graphic->render_mode == RENDER_MODE_CATCH_UP) {
+        /* the queue holds a whole frame, it is drained at V-BLANK */
+        worker->lines[worker->head++ % WORKER_QUEUE_LINES] = *regs;
+        return;
     }
 
-    return bg_color;
+    /* nothing is queued since the last sync, the worker is idle */
+    if (worker->snapshot_stale)
+        snapshot_refresh(graphic);
+
+    pthread_mutex_lock(&worker->lock);
+    worker->line_writes[worker->head % WORKER_QUEUE_LINES] = worker->write_head;
+    worker->lines[worker->head++ % WORKER_QUEUE_LINES] = *regs;
+    worker->write_seen = worker->write_tail;
+    /* waking the worker up costs more than drawing a line, it is woken up for a batch */
+    if (worker->head - worker->tail >= WORKER_BATCH_LINES)
+        pthread_cond_signal(&worker->work);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+void
+gbc_graphic_sync(gbc_graphic_t *graphic)
+{
+    gbc_graphic_worker_t *worker = &graphic->worker;
+    if (graphic->render_mode == RENDER_MODE_LINE)
+        return;
+    /* the caller may change the live state without logging it, e.g. OAM DMA */
+    worker->snapshot_stale = 1;
+    /* nothing was queued since the queue was last seen empty */
+    if (worker->drained == worker->head)
+        return;
+
+    if (graphic->render_mode == RENDER_MODE_CATCH_UP) {
+        while (worker->tail != worker->head)
+            graphic->draw_line(graphic, &worker->lines[worker->tail++ % WORKER_QUEUE_LINES]);
+        worker->drained = worker->head;
+        return;
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->head != worker->tail)
+        pthread_cond_signal(&worker->work);
+    while (worker->head != worker->tail)
+        pthread_cond_wait(&worker->idle, &worker->lock);
+    worker->drained = worker->head;
+    pthread_mutex_unlock(&worker->lock);
 }
 
 static void
-gbc_graphic_draw_line(gbc_graphic_t *graphic, uint16_t scanline)
+graphic_sync(void *udata)
 {
-    int16_t scanline_base = scanline * VISIBLE_HORIZONTAL_PIXELS;
+    gbc_graphic_sync((gbc_graphic_t*)udata);
+}
 
-    /* scan objs */
-    uint8_t objs = 0;
-    uint8_t lcdc = IO_PORT_READ(graphic->mem, IO_PORT_LCDC);
-    uint8_t obj_height = lcdc & LCDC_OBJ_SIZE ? OBJ_HEIGHT_2 : OBJ_HEIGHT;
+/* before VRAM, OAM or a host palette color changes */
+static void
+graphic_write(void *udata, uint8_t target, uint16_t addr, uint32_t data)
+{
+    gbc_graphic_t *graphic = (gbc_graphic_t*)udata;
+    gbc_graphic_worker_t *worker = &graphic->worker;
+
+    if (graphic->render_mode != RENDER_MODE_THREAD) {
+        gbc_graphic_sync(graphic);
+        return;
+    }
+
+    /* the worker hasn't replayed the oldest writes yet, it is waited for like the other modes do */
+    if (!worker->snapshot_stale && worker->write_head - worker->write_seen >= WORKER_QUEUE_WRITES)
+        gbc_graphic_sync(graphic);
+    /* the snapshot is compared with the live state anyway */
+    if (worker->snapshot_stale)
+        return;
+
+    gbc_graphic_write_t *write = &worker->snapshot->writes[worker->write_head++ % WORKER_QUEUE_WRITES];
+    write->target = target;
+    write->addr = addr;
+    write->data = data;
+}
 
+/* the lines are drawn from the live state, or from the snapshot in RENDER_MODE_THREAD */
+static void
+draw_source(gbc_graphic_t *graphic)
+{
+    gbc_graphic_snapshot_t *snapshot = graphic->worker.snapshot;
+    gbc_memory_t *mem = graphic->mem;
+
+    graphic->draw_vram = snapshot ? snapshot->vram : graphic->vram;
+    graphic->draw_oam = snapshot ? snapshot->oam : mem->oam;
+    graphic->draw_oam_dirty = snapshot ? &snapshot->oam_dirty : &mem->oam_dirty;
+    graphic->draw_palette = snapshot ? snapshot->host_palette : mem->host_palette;
+}
+
+static int
+worker_start(gbc_graphic_t *graphic)
+{
+    gbc_graphic_worker_t *worker = &graphic->worker;
+    gbc_graphic_snapshot_t *snapshot = (gbc_graphic_snapshot_t*)malloc_memory(sizeof(gbc_graphic_snapshot_t));
+
+    if (!snapshot) {
+        LOG_ERROR("[GRAPHIC] Failed to allocate the render thread snapshot\n");
+        return 1;
+    }
+    /* the caches are up to date with the live state, so is the snapshot */
+    memcpy(snapshot->vram, graphic->vram, sizeof(snapshot->vram));
+    memcpy(snapshot->oam, graphic->mem->oam, sizeof(snapshot->oam));
+    snapshot->oam_dirty = graphic->mem->oam_dirty;
+    memcpy(snapshot->host_palette, graphic->mem->host_palette, sizeof(snapshot->host_palette));
+    worker->snapshot = snapshot;
+    worker->snapshot_stale = 0;
+    worker->write_head = worker->write_tail = worker->write_seen = 0;
+
+    worker->stop = 0;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->work, NULL);
+    pthread_cond_init(&worker->idle, NULL);
+    if (pthread_create(&worker->thread, NULL, worker_main, graphic)) {
+        LOG_ERROR("[GRAPHIC] Failed to start the render thread\n");
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->work);
+        pthread_cond_destroy(&worker->idle);
+        free_memory(worker->snapshot);
+        worker->snapshot = NULL;
+        return 1;
+    }
+    draw_source(graphic);
+    return 0;
+}
+
+static void
+worker_stop(gbc_graphic_t *graphic)
+{
+    gbc_graphic_worker_t *worker = &graphic->worker;
+
+    pthread_mutex_lock(&worker->lock);
+    worker->stop = 1;
+    pthread_cond_signal(&worker->work);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->work);
+    pthread_cond_destroy(&worker->idle);
+
+    free_memory(worker->snapshot);
+    worker->snapshot = NULL;
+    draw_source(graphic);
+    /* the caches may have been drawn from a snapshot older than the live state */
+    gbc_graphic_invalidate_tiles(graphic);
+    *graphic->draw_oam_dirty = 1;
+}
+
+int
+gbc_graphic_set_render_mode(gbc_graphic_t *graphic, uint8_t mode)
+{
+    if (mode == graphic->render_mode)
+        return 0;
+
+    /* the queued lines are drawn with the old mode */
+    gbc_graphic_sync(graphic);
+    if (graphic->render_mode == RENDER_MODE_THREAD)
+        worker_stop(graphic);
+
+    graphic->worker.head = graphic->worker.tail = graphic->worker.drained = 0;
+    if (mode == RENDER_MODE_THREAD && worker_start(graphic)) {
+        graphic->render_mode = RENDER_MODE_LINE;
+        return 1;
+    }
+
+    graphic->render_mode = mode;
+    return 0;
+}
+
+/* decided at V-BLANK, for the frame coming next */
+static uint8_t
+frame_skip_next(gbc_graphic_t *graphic)
+{
+    switch (graphic->frame_skip_mode) {
+    case FRAME_SKIP_FIXED:
+        return graphic->frame_skipped < graphic->frame_skip;
+    case FRAME_SKIP_ADAPTIVE:
+        return graphic->host_late && graphic->frame_skipped < graphic->frame_skip;
+    case FRAME_SKIP_ALL:
+        return 1;
+    }
+    return 0;
+}
+
+void
+gbc_graphic_set_frame_skip(gbc_graphic_t *graphic, uint8_t mode, uint8_t frames)
+{
+    graphic->frame_skip_mode = mode;
+    graphic->frame_skip = frames;
+    graphic->frame_skipped = 0;
+    graphic->skip_frame = frame_skip_next(graphic);
+}
+
+void
+gbc_graphic_set_frame_blend(gbc_graphic_t *graphic, uint8_t weight)
+{
+    graphic->frame_blend = weight;
+    /* the front buffer may be anything, e.g. zeros with no alpha */
+    graphic->blend_format = PIXEL_FORMATS;
+}
+
+void
+gbc_graphic_set_dmg_compat(gbc_graphic_t *graphic, uint8_t enable)
+{
+    /* the queued lines are drawn the way they were queued */
+    gbc_graphic_sync(graphic);
+    graphic->dmg_compat = enable;
+    graphic->draw_line = enable ? gbc_graphic_draw_line_dmg : gbc_graphic_draw_line;
+}
+
+int
+gbc_graphic_set_layer_cache(gbc_graphic_t *graphic, uint8_t enable)
+{
+    if (!enable == !graphic->layers)
+        return 0;
+
+    /* the queued lines may be drawn from it */
+    gbc_graphic_sync(graphic);
+    if (!enable) {
+        free_memory(graphic->layers);
+        graphic->layers = NULL;
+        return 0;
+    }
+
+    graphic->layers = (gbc_layer_cache_t*)malloc_memory(sizeof(gbc_layer_cache_t));
+    if (!graphic->layers) {
+        LOG_ERROR("[GRAPHIC] Failed to allocate the layer cache\n");
+        return 1;
+    }
+    memset(graphic->layers, 0, sizeof(gbc_layer_cache_t));
+    gbc_graphic_invalidate_tiles(graphic);
+    return 0;
+}
+
+const gbc_frame_info_t*
+gbc_graphic_frame_info(gbc_graphic_t *graphic)
+{
+    return &graphic->frame_info;
+}
+
+/* the pixels of a dirty line that changed, the whole line if there is nothing to compare with */
+static inline uint8_t
+line_damage(gbc_graphic_t *graphic, uint8_t line, uint8_t *first, uint8_t *last)
+{
+    uint8_t format = graphic->mem->pixel_format;
+    uint8_t bpp = PIXEL_FORMAT_BYTES(format);
+    int from, to;
+
+    if (format != graphic->front_format) {
+        *first = 0;
+        *last = VISIBLE_HORIZONTAL_PIXELS - 1;
+        return 1;
+    }
+
+    const uint8_t *front = (const uint8_t*)graphic->framebuffer[graphic->front] + line * FRAMEBUFFER_STRIDE(format);
+    graphic->simd->row_diff(back_line(graphic, line), front, FRAMEBUFFER_STRIDE(format), &from, &to);
+    if (to < 0)
+        return 0;
+    *first = from / bpp;
+    *last = to / bpp;
+    return 1;
+}
+
+/* compares the back buffer with the front buffer, before they are swapped */
+static void
+frame_info_update(gbc_graphic_t *graphic)
+{
+    gbc_frame_info_t *info = &graphic->frame_info;
+    gbc_frame_rect_t *rect = NULL;
+    uint8_t rect_last = 0;
+    /* the same bytes are other pixels now */
+    uint8_t reformat = graphic->mem->pixel_format != graphic->front_format;
+
+    info->hash = 0;
+    info->changed = 0;
+    info->rect_count = 0;
+    memset(info->dirty, 0, sizeof(info->dirty));
+
+    for (int line = 0; line < VISIBLE_VERTICAL_PIXELS; line++) {
+        uint32_t bit = 1u << (line % 32);
+        uint8_t first, last;
+
+        /* a line that was not drawn, e.g. the LCD was turned off, still has the frame before the last one */
+        if (!(graphic->lines_drawn[line / 32] & bit))
+            graphic->line_hash[line] = line_hash(back_line(graphic, line), FRAMEBUFFER_STRIDE(graphic->mem->pixel_format));
+        info->hash = (info->hash ^ graphic->line_hash[line]) * 0x100000001b3;
+
+        if ((!reformat && graphic->line_hash[line] == graphic->front_line_hash[line]) ||
+            !line_damage(graphic, line, &first, &last)) {
+            rect = NULL;
+            continue;
+        }
+        info->dirty[line / 32] |= bit;
+        info->changed = 1;
+
+        if (rect) {
+            /* the line below the rect, it grows */
+            uint8_t x = rect->x < first ? rect->x : first;
+            rect_last = rect_last > last ? rect_last : last;
+            rect->x = x;
+            rect->width = rect_last - x + 1;
+            rect->height++;
+        } else {
+            rect = &info->rects[info->rect_count++];
+            rect->x = first;
+            rect->y = line;
+            rect->width = last - first + 1;
+            rect->height = 1;
+            rect_last = last;
+        }
+    }
+
+    memcpy(graphic->front_line_hash, graphic->line_hash, sizeof(graphic->line_hash));
+    memset(graphic->lines_drawn, 0, sizeof(graphic->lines_drawn));
+}
+
+/*
+Ghosting of the LCD, the finished frame is mixed with the one on screen, which is already a mix
+of the ones before it. The lines are hashed again, they all changed.
+*/
+static void
+frame_blend(gbc_graphic_t *graphic)
+{
+    uint8_t format = graphic->mem->pixel_format;
+    uint8_t weight = graphic->frame_blend;
+    uint8_t *cur = (uint8_t*)graphic->framebuffer[graphic->front ^ 1];
+    const uint8_t *prev = (const uint8_t*)graphic->framebuffer[graphic->front];
+
+    /* there is nothing to mix with after the format changed, palette indexes can't be mixed at all */
+    uint8_t blend = format == graphic->blend_format && format != PIXEL_FORMAT_INDEXED8;
+    graphic->blend_format = format;
+    if (!blend)
+        return;
+
+    if (format == PIXEL_FORMAT_RGB565) {
+        uint16_t *c = (uint16_t*)cur;
+        const uint16_t *p = (const uint16_t*)prev;
+        for (int i = 0; i < FRAMEBUFFER_PIXELS; i++) {
+            uint32_t r = ((c[i] >> 11) * (256 - weight) + (p[i] >> 11) * weight + 128) >> 8;
+            uint32_t g = (((c[i] >> 5) & 0x3f) * (256 - weight) + ((p[i] >> 5) & 0x3f) * weight + 128) >> 8;
+            uint32_t b = ((c[i] & 0x1f) * (256 - weight) + (p[i] & 0x1f) * weight + 128) >> 8;
+            c[i] = r << 11 | g << 5 | b;
+        }
+    } else {
+        graphic->simd->frame_blend(prev, cur, FRAMEBUFFER_STRIDE(format) * VISIBLE_VERTICAL_PIXELS, weight);
+    }
+
+    for (int line = 0; line < VISIBLE_VERTICAL_PIXELS; line++)
+        graphic->line_hash[line] = line_hash(back_line(graphic, line), FRAMEBUFFER_STRIDE(format));
+    memset(graphic->lines_drawn, 0xff, sizeof(graphic->lines_drawn));
+}
+
+/*
+A pixel format change is only applied between two frames, a frame with lines of both formats would
+have two strides. The back buffer is blanked in the new format, the lines the next frame doesn't draw
+still have the frame before the last one otherwise.
+*/
+static void
+pixel_format_update(gbc_graphic_t *graphic)
+{
+    uint8_t colors[VISIBLE_HORIZONTAL_PIXELS];
+
+    if (!gbc_mem_pixel_format_apply(graphic->mem))
+        return;
+
+    uint8_t format = graphic->mem->pixel_format;
+    memset(colors, HOST_PALETTE_BLANK, sizeof(colors));
+    /* the live palette, the render thread's copy may not have the new format yet */
+    for (int line = 0; line < VISIBLE_VERTICAL_PIXELS; line++)
+        graphic->simd->palette_lookup(graphic->mem->host_palette, colors, back_line(graphic, line),
+            VISIBLE_HORIZONTAL_PIXELS, PIXEL_FORMAT_BYTES(format));
+}
+
+/* the back buffer is complete, hand it over without copying */
+static void
+gbc_graphic_present(gbc_graphic_t *graphic)
+{
+    gbc_graphic_sync(graphic);
+    if (graphic->lcd_warmup) {
+        /* the first frame after the LCD is turned on is not shown, the blank one stays */
+        graphic->lcd_warmup = 0;
+    } else if (graphic->skip_frame) {
+        graphic->frame_skipped++;
+    } else {
+        graphic->frame_skipped = 0;
+        if (graphic->frame_blend)
+            frame_blend(graphic);
+        frame_info_update(graphic);
+        graphic->front ^= 1;
+        graphic->front_format = graphic->mem->pixel_format;
+        if (graphic->frame_ready)
+            graphic->frame_ready(graphic->screen_udata, graphic->framebuffer[graphic->front],
+                FRAMEBUFFER_STRIDE(graphic->mem->pixel_format), graphic->mem->pixel_format);
+    }
+    pixel_format_update(graphic);
+    graphic->skip_frame = frame_skip_next(graphic);
+}
+
+/* draws the line now or queues it, depending on the render mode */
+static inline void
+line_submit(gbc_graphic_t *graphic, const gbc_line_regs_t *regs)
+{
+    if (graphic->render_mode != RENDER_MODE_LINE)
+        line_queue(graphic, regs);
+    else
+        graphic->draw_line(graphic, regs);
+}
+
+static inline uint8_t
+window_shown(const gbc_line_regs_t *regs)
+{
+    uint8_t window_x = regs->wx - 7;
+    return (regs->lcdc & LCDC_WINDOW_ENABLE) && regs->window_line != WINDOW_LINE_NONE &&
+        window_x < VISIBLE_HORIZONTAL_PIXELS;
+}
+
+/*
+https://gbdev.io/pandocs/Rendering.html#mode-3-length
+The pixels of SCX % 8 are fetched and thrown away, the window restarts the fetcher, and every obj
+stalls it for 6 dots, plus the rest of the BG or window tile under its left pixel, less 2, for the
+first obj on that tile. The objs are those of the OAM scan, the first 10 on the line.
+*/
+static uint16_t
+mode3_length(gbc_graphic_t *graphic, const gbc_line_regs_t *regs)
+{
+    uint16_t dots = PPU_MODE_3_MIN_DOTS + (regs->scx & 7);
+    uint8_t window = window_shown(regs);
+
+    if (window)
+        dots += 6;
+    if (!(regs->lcdc & LCDC_OBJ_ENABLE))
+        return dots;
+
+    /* the OAM X of the objs on the line, left to right */
     gbc_obj_t *obj = (gbc_obj_t*)OAM_ADDR(graphic->mem);
-    uint8_t objs_idx[MAX_OBJ_SCANLINE];
+    uint8_t obj_height = regs->lcdc & LCDC_OBJ_SIZE ? OBJ_HEIGHT_2 : OBJ_HEIGHT;
+    uint8_t xs[MAX_OBJ_SCANLINE];
+    int count = 0;
 
-    for (int i = 0; i < MAX_OBJS; i++, obj++) {
+    for (int i = 0; i < MAX_OBJS && count < MAX_OBJ_SCANLINE; i++, obj++) {
         uint8_t y = OAM_Y_TO_SCREEN(obj->y);
+        /* as in obj_index_get(), y wraps around when Y < 16 */
+        if (regs->scanline < y || regs->scanline >= y + obj_height)
+            continue;
+        int j = count++;
+        for (; j > 0 && xs[j - 1] > obj->x; j--)
+            xs[j] = xs[j - 1];
+        xs[j] = obj->x;
+    }
 
-        if (scanline >= y && scanline < y + obj_height) {
-            objs_idx[objs++] = i;
-            if (objs == MAX_OBJ_SCANLINE) {
-                break;
-            }
+    int last_tile = -1;
+    for (int i = 0; i < count; i++) {
+        /* objs right of the screen are never reached */
+        if (xs[i] >= VISIBLE_HORIZONTAL_PIXELS + OBJ_WIDTH)
+            break;
+
+        /* OAM X is the screen x + 8, it has the same position in a tile */
+        int tile, x;
+        if (window && xs[i] > regs->wx) {
+            x = (xs[i] - regs->wx - 1) % TILE_SIZE;
+            tile = TILE_MAP_SIZE + (xs[i] - regs->wx - 1) / TILE_SIZE;
+        } else {
+            x = (xs[i] + regs->scx) % TILE_SIZE;
+            tile = (xs[i] + regs->scx) / TILE_SIZE;
         }
+        if (tile != last_tile && x < 5)
+            dots += 5 - x;
+        last_tile = tile;
+        dots += 6;
     }
+    return dots;
+}
+
+/* mode 3 starts, the line is drawn when it ends, or in pieces if registers are written before */
+static uint16_t
+dot_line_start(gbc_graphic_t *graphic, gbc_line_regs_t *regs)
+{
+    /* https://gbdev.io/pandocs/Scrolling.html#window */
+    if (regs->scanline == regs->wy)
+        graphic->window_wy = 1;
+    regs->window_line = graphic->window_wy ? graphic->window_line : WINDOW_LINE_NONE;
+
+    graphic->line_regs = *regs;
+    graphic->line_stale = 0;
+    graphic->line_pending = !graphic->skip_frame && !graphic->lcd_warmup;
+    graphic->window_shown = window_shown(regs);
+    graphic->mode3_dots = mode3_length(graphic, regs);
+    return graphic->mode3_dots;
+}
+
+/* the registers written during mode 3, except the fine scroll, it is only read when the line starts */
+static void
+dot_line_reread(gbc_graphic_t *graphic)
+{
+    gbc_line_regs_t *regs = &graphic->line_regs;
+    gbc_line_regs_t old = *regs;
+
+    line_regs_read(graphic, old.scanline, regs);
+    regs->scx = (regs->scx & ~7) | (old.scx & 7);
+    regs->window_line = old.window_line;
+    regs->x_from = old.x_from;
+    graphic->window_shown |= window_shown(regs);
+    graphic->line_stale = 0;
+}
 
-    for (uint16_t i = 0; i < VISIBLE_HORIZONTAL_PIXELS; i++) {
-        uint16_t color = gbc_graphic_render_pixel(graphic, scanline, i, objs_idx, objs);
-        graphic->screen_write(graphic->screen_udata, scanline_base + i, color);
+/* draws the pending line up to pixel x */
+static void
+dot_line_draw(gbc_graphic_t *graphic, uint8_t x)
+{
+    gbc_line_regs_t *regs = &graphic->line_regs;
+
+    if (graphic->line_stale)
+        dot_line_reread(graphic);
+    if (!graphic->line_pending || x <= regs->x_from)
+        return;
+    regs->x_to = x;
+    line_submit(graphic, regs);
+    regs->x_from = x;
+}
+
+/* mode 3 ends, returns the length of mode 0 */
+static uint16_t
+dot_line_end(gbc_graphic_t *graphic)
+{
+    dot_line_draw(graphic, VISIBLE_HORIZONTAL_PIXELS);
+    graphic->line_pending = 0;
+    if (graphic->window_shown)
+        graphic->window_line++;
+    graphic->window_shown = 0;
+    return DOTS_PER_SCANLINE - PPU_MODE_2_DOTS - graphic->mode3_dots;
+}
+
+/*
+A register is about to be written, the pixels pushed so far are drawn with the old value.
+They come out 12 dots after mode 3 starts, once the SCX % 8 pixels are thrown away, the
+stalls of the objs are not placed, they are only counted in the length of mode 3.
+*/
+static void
+ppu_write(void *udata)
+{
+    gbc_graphic_t *graphic = (gbc_graphic_t*)udata;
+
+    if (graphic->mode != PPU_MODE_3)
+        return;
+
+    int x = graphic->mode3_dots - graphic->dots - (PPU_MODE_3_MIN_DOTS - VISIBLE_HORIZONTAL_PIXELS) -
+        (graphic->line_regs.scx & 7);
+    x = x < 0 ? 0 : x > VISIBLE_HORIZONTAL_PIXELS ? VISIBLE_HORIZONTAL_PIXELS : x;
+    dot_line_draw(graphic, x);
+    graphic->line_stale = 1;
+}
+
+void
+gbc_graphic_finish_line(gbc_graphic_t *graphic)
+{
+    /* the current mode keeps its length */
+    dot_line_draw(graphic, VISIBLE_HORIZONTAL_PIXELS);
+    graphic->line_pending = 0;
+    graphic->window_shown = 0;
+    graphic->mode3_dots = PPU_MODE_3_DOTS;
+}
+
+int
+gbc_graphic_set_accuracy(gbc_graphic_t *graphic, uint8_t accuracy)
+{
+    if (accuracy >= PPU_ACCURACIES) {
+        LOG_ERROR("[GRAPHIC] Invalid PPU accuracy %d\n", accuracy);
+        return 1;
     }
+    if (accuracy == graphic->accuracy)
+        return 0;
+
+    gbc_graphic_finish_line(graphic);
+    graphic->accuracy = accuracy;
+    graphic->mem->ppu_write = accuracy == PPU_ACCURACY_DOT ? ppu_write : NULL;
+    return 0;
 }
 
 void
 gbc_graphic_cycle(gbc_graphic_t *graphic)
 {
-    if (graphic->dots--) {
+    if (graphic->dots) {
+        graphic->dots--;
         return;
     }
+    gbc_graphic_event(graphic);
+}
 
+/* LY and the LYC=LY flag and interrupt, returns the new STAT */
+static inline uint8_t
+ly_write(gbc_graphic_t *graphic, uint8_t scanline, uint8_t io_stat)
+{
+    graphic->scanline = scanline;
+    IO_PORT_WRITE(graphic->mem, IO_PORT_LY, scanline);
+    uint8_t lyc = IO_PORT_READ(graphic->mem, IO_PORT_LYC);
+    io_stat &= ~STAT_LYC_LY;
+    if (lyc == scanline) {
+        io_stat |= STAT_LYC_LY;
+        if (io_stat & STAT_LYC_INT) {
+            REQUEST_INTERRUPT(graphic->mem, INTERRUPT_LCD_STAT);
+        }
+    }
+    return io_stat;
+}
+
+uint32_t
+gbc_graphic_event(gbc_graphic_t *graphic)
+{
     uint8_t io_lcdc = IO_PORT_READ(graphic->mem, IO_PORT_LCDC);
 
     if (io_lcdc & LCDC_PPU_ENABLE) {
@@ -283,7 +1255,10 @@ gbc_graphic_cycle(gbc_graphic_t *graphic)
         if (scanline <= VISIBLE_SCANLINES) {
             if (graphic->mode == PPU_MODE_3) {
                 /* HORIZONTAL BLANK */
-                graphic->dots = PPU_MODE_0_DOTS;
+                if (graphic->accuracy == PPU_ACCURACY_DOT)
+                    graphic->dots = dot_line_end(graphic);
+                else
+                    graphic->dots = PPU_MODE_0_DOTS;
                 graphic->mode = PPU_MODE_0;
                 if (io_stat & STAT_MODE_0_INT) {
                     REQUEST_INTERRUPT(graphic->mem, INTERRUPT_LCD_STAT);
@@ -291,9 +1266,19 @@ gbc_graphic_cycle(gbc_graphic_t *graphic)
 
             } else if (graphic->mode == PPU_MODE_2) {
                 /* DRAWING */
-                graphic->dots = PPU_MODE_3_DOTS;
                 graphic->mode = PPU_MODE_3;
-                gbc_graphic_draw_line(graphic, scanline);
+                if (graphic->accuracy == PPU_ACCURACY_DOT) {
+                    gbc_line_regs_t regs;
+                    line_regs_read(graphic, scanline, &regs);
+                    graphic->dots = dot_line_start(graphic, &regs);
+                } else {
+                    graphic->dots = PPU_MODE_3_DOTS;
+                    if (!graphic->skip_frame && !graphic->lcd_warmup) {
+                        gbc_line_regs_t regs;
+                        line_regs_read(graphic, scanline, &regs);
+                        line_submit(graphic, &regs);
+                    }
+                }
             } else if (graphic->mode == PPU_MODE_0 || graphic->mode == PPU_MODE_1) {
                 if (graphic->mode != PPU_MODE_1)
                     scanline++;
@@ -313,6 +1298,11 @@ gbc_graphic_cycle(gbc_graphic_t *graphic)
                 }
                 REQUEST_INTERRUPT(graphic->mem, INTERRUPT_VBLANK);
                 graphic->mode = PPU_MODE_1;
+                graphic->window_wy = 0;
+                graphic->window_line = 0;
+                gbc_graphic_present(graphic);
+                if (graphic->vblank)
+                    graphic->vblank(graphic->vblank_udata);
             }
 
             graphic->dots = PPU_MODE_1_DOTS;
@@ -325,24 +1315,62 @@ gbc_graphic_cycle(gbc_graphic_t *graphic)
         io_stat &= ~PPU_MODE_MASK;
         io_stat |= graphic->mode & PPU_MODE_MASK;
 
-        if (graphic->scanline != scanline) {
-            graphic->scanline = scanline;
-            IO_PORT_WRITE(graphic->mem, IO_PORT_LY, scanline);
-            uint8_t lyc = IO_PORT_READ(graphic->mem, IO_PORT_LYC);
-            io_stat &= ~STAT_LYC_LY;
-            if (lyc == scanline) {
-                io_stat |= STAT_LYC_LY;
-                if (io_stat & STAT_LYC_INT) {
-                    REQUEST_INTERRUPT(graphic->mem, INTERRUPT_LCD_STAT);
-                }
-            }
-        }
+        if (graphic->scanline != scanline)
+            io_stat = ly_write(graphic, scanline, io_stat);
 
         IO_PORT_WRITE(graphic->mem, IO_PORT_STAT, io_stat);
     } else {
+        /* parked, lcd_switch() starts it again */
         graphic->dots = DOTS_PER_SCANLINE * TOTAL_SCANLINES;
         LOG_DEBUG("[GRAPHIC] PPU DISABLED\n");
     }
+    return graphic->dots;
+}
+
+/* what the screen shows while the LCD is off, handed over once */
+static void
+lcd_blank_frame(gbc_graphic_t *graphic)
+{
+    uint8_t colors[VISIBLE_HORIZONTAL_PIXELS];
+
+    memset(colors, HOST_PALETTE_OFF, sizeof(colors));
+    for (int line = 0; line < VISIBLE_VERTICAL_PIXELS; line++)
+        line_output(graphic, line, colors, 0, VISIBLE_HORIZONTAL_PIXELS);
+    graphic->skip_frame = 0;
+    gbc_graphic_present(graphic);
+}
+
+/*
+https://gbdev.io/pandocs/LCDC.html#lcdc7--lcd-and-ppu-enable
+Off, LY and the mode go to 0 and the screen goes blank, nothing is drawn or handed over after the
+blank frame. On, line 0 starts right away without an OAM scan, STAT reads mode 0 until the drawing,
+and the first frame is not shown.
+*/
+static void
+lcd_switch(void *udata, uint8_t enable)
+{
+    gbc_graphic_t *graphic = (gbc_graphic_t*)udata;
+    uint8_t io_stat = IO_PORT_READ(graphic->mem, IO_PORT_STAT) & ~PPU_MODE_MASK;
+
+    gbc_graphic_sync(graphic);
+    if (enable) {
+        graphic->mode = PPU_MODE_2;
+        graphic->dots = PPU_MODE_2_DOTS;
+        graphic->lcd_warmup = 1;
+        graphic->window_wy = 0;
+        graphic->window_line = 0;
+        io_stat = ly_write(graphic, 0, io_stat);
+    } else {
+        graphic->mode = PPU_MODE_0;
+        graphic->dots = DOTS_PER_SCANLINE * TOTAL_SCANLINES;
+        graphic->lcd_warmup = 0;
+        graphic->line_pending = 0;
+        graphic->window_shown = 0;
+        graphic->scanline = 0;
+        IO_PORT_WRITE(graphic->mem, IO_PORT_LY, 0);
+        lcd_blank_frame(graphic);
+    }
+    IO_PORT_WRITE(graphic->mem, IO_PORT_STAT, io_stat);
 }
 
 inline static void*
@@ -373,9 +1401,14 @@ vram_write(void *udata, uint16_t addr, uint8_t data)
 {
     gbc_graphic_t *graphic = (gbc_graphic_t*)udata;
     uint8_t bank = IO_PORT_READ(graphic->mem, IO_PORT_VBK) & 0x01;
+    uint16_t offset = bank * VRAM_BANK_SIZE + addr - VRAM_BEGIN;
     // LOG_DEBUG("[GRAPHIC] Writing to VRAM %x [%x], bank: %d\n", addr, data, bank);
-    *(uint8_t*)vram_addr(udata, addr) = data;
+    graphic_write(graphic, RENDER_WRITE_VRAM, offset, data);
+    graphic->vram[offset] = data;
 
+    /* the worker keeps the caches of its snapshot up to date */
+    if (!graphic->worker.snapshot)
+        vram_changed(graphic, offset);
     return data;
 }
 
@@ -383,6 +1416,14 @@ void
 gbc_graphic_connect(gbc_graphic_t *graphic, gbc_memory_t *mem)
 {
     graphic->mem = mem;
+    mem->render_sync = graphic_sync;
+    mem->render_write = graphic_write;
+    mem->render_sync_udata = graphic;
+    mem->lcd_switch = lcd_switch;
+    mem->lcd_switch_udata = graphic;
+    mem->ppu_write = graphic->accuracy == PPU_ACCURACY_DOT ? ppu_write : NULL;
+    mem->ppu_write_udata = graphic;
+    draw_source(graphic);
 
     memory_map_entry_t entry;
     entry.id = VRAM_ID;
@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include "memory.h"
+#include "simd.h"
+#include <pthread.h>
 
 typedef struct gbc_graphic gbc_graphic_t;
 typedef struct gbc_tile gbc_tile_t;
@@ -10,7 +12,13 @@ typedef struct gbc_tilemap gbc_tilemap_t;
 typedef struct gbc_tilemap_attr gbc_tilemap_attr_t;
 typedef struct gbc_obj gbc_obj_t;
 
-typedef void (*screen_write)(void *udata, uint16_t addr, uint16_t data);
+/*
+A finished frame, top-left pixel first, stride is in bytes, format is one of PIXEL_FORMAT_*.
+The buffer belongs to the frontend until the next frame_ready, the PPU draws into the other one.
+*/
+typedef void (*frame_ready)(void *udata, const void *buffer, uint16_t stride, uint8_t format);
+/* optional, a scanline was just drawn into the back buffer */
+typedef void (*line_ready)(void *udata, uint8_t scanline, const void *pixels);
 
 #define VRAM_BANK_SIZE (VRAM_END-VRAM_BEGIN+1)
 
@@ -20,6 +28,7 @@ I implemented a simplified model of the GameBoy PPU.
 Graphic cycle runs every 80dots, every scanline costs 6 graphic cycles (480 dots)
 The first cycle is mode 2, the next 3 cycles are in mode 3, the rests are in mode 0.
 Every mode has a fixed inverval, unlike the real GameBoy.
+PPU_ACCURACY_DOT gives mode 3 the length of the pixel FIFO instead, see gbc_graphic_set_accuracy().
 
 TODO: Using cpu cycles may be better?
 */
@@ -40,6 +49,7 @@ TODO: Using cpu cycles may be better?
 #define PPU_MODE_0_DOTS 100 /* 87 ~ 204, i randomly picked 100 */
 #define PPU_MODE_3_DOTS (DOTS_PER_SCANLINE - PPU_MODE_0_DOTS - PPU_MODE_2_DOTS)
 #define PPU_MODE_1_DOTS DOTS_PER_SCANLINE
+#define PPU_MODE_3_MIN_DOTS 172   /* 160 pixels and 12 dots to fill the FIFO */
 
 #define DOTS_MODEL_2_START   0
 #define DOTS_MODEL_3_START    (PPU_MODE_2_DOTS)
@@ -73,6 +83,12 @@ TODO: Using cpu cycles may be better?
 #define OBJ_HEIGHT 8
 #define OBJ_HEIGHT_2 16
 
+/* tile data is 0x8000-0x97FF in both banks, 384 tiles per bank */
+#define TILE_DATA_END 0x97FF
+#define TILE_BYTES 16
+#define TILES_PER_BANK ((TILE_DATA_END - VRAM_BEGIN + 1) / TILE_BYTES)
+#define TILE_CACHE_TILES (TILES_PER_BANK * 2)
+
 #define TILE_TYPE_OBJ  1
 #define TILE_TYPE_BG   2
 #define TILE_TYPE_WIN  3
@@ -90,6 +106,18 @@ TODO: Using cpu cycles may be better?
 
 #define GBC_COLOR_TO_RGB(x) (GBC_COLOR_TO_RGB_R(x) << 10 | GBC_COLOR_TO_RGB_G(x) << 5 | GBC_COLOR_TO_RGB_B(x))
 
+/*
+Skipped frames keep every mode change, interrupt and LY update, only the scanlines are not drawn
+and no frame_ready is called, so the emulation runs exactly the same.
+*/
+#define FRAME_SKIP_OFF      0   /* every frame is drawn */
+#define FRAME_SKIP_FIXED    1   /* draws one frame, then skips frame_skip frames */
+#define FRAME_SKIP_ADAPTIVE 2   /* skips while the host is late, at most frame_skip frames in a row */
+#define FRAME_SKIP_ALL      3   /* nothing is drawn, e.g. batch runs */
+
+#define FRAMEBUFFER_PIXELS (VISIBLE_HORIZONTAL_PIXELS * VISIBLE_VERTICAL_PIXELS)
+#define FRAMEBUFFER_STRIDE(format) (VISIBLE_HORIZONTAL_PIXELS * PIXEL_FORMAT_BYTES(format))
+
 #define MAX_OBJ_SCANLINE 10
 #define MAX_OBJS ((OAM_END - OAM_BEGIN + 1) / 4)
 
@@ -98,6 +126,7 @@ TODO: Using cpu cycles may be better?
 #define OBJ_ATTR_XFLIP(x) ((x) & 0x20)
 #define OBJ_ATTR_YFLIP(x) ((x) & 0x40)
 #define OBJ_ATTR_BG_PRIORITY(x) ((x) & 0x80)
+#define OBJ_ATTR_DMG_PALETTE(x) ((x) & 0x10)   /* OBP0 or OBP1, DMG compatibility mode */
 
 #define OAM_Y_TO_SCREEN(y) ((y) - 16)
 #define OAM_X_TO_SCREEN(x) ((x) - 8)
@@ -107,16 +136,250 @@ TODO: Using cpu cycles may be better?
     ((td)->data[y * 2] & (1 << (7 - x)) ? 1 : 0) + \
     ((td)->data[y * 2 + 1] & (1 << (7 - x)) ? 2 : 0)
 
+typedef struct gbc_tile_cache gbc_tile_cache_t;
+
+/*
+Every tile of both banks decoded to one color id per pixel, as is and x flipped.
+vram_write() marks the tile dirty, it is decoded again the next time it is used.
+*/
+struct gbc_tile_cache
+{
+    uint8_t pixels[TILE_CACHE_TILES][2][TILE_SIZE * TILE_SIZE];
+    uint8_t dirty[TILE_CACHE_TILES];
+};
+
+typedef struct gbc_layer gbc_layer_t;
+typedef struct gbc_layer_cache gbc_layer_cache_t;
+
+#define LAYER_CELLS (32 * 32)
+#define TILEMAP_BEGIN 0x9800
+#define TILEMAP_BYTES 0x400
+
+/*
+A tilemap(0x9800 or 0x9C00) drawn as 256x256 pixels of BG, one plane per field of gbc_simd_line_t.
+The lines of the BG and the window are copied out of it. A cell(tile) is drawn again when its tilemap
+entry or attributes are written, when its tile is written, or when LCDC.4 picks the other tiles.
+*/
+struct gbc_layer
+{
+    uint8_t tile_data;                  /* LCDC_BG_WINDOW_TILE_DATA the cells were drawn with */
+    uint8_t dirty[LAYER_CELLS];
+    uint16_t tile[LAYER_CELLS];         /* tile cache index of every cell */
+    uint32_t generation[LAYER_CELLS];   /* of the tile when the cell was drawn */
+    uint8_t priority_cell[LAYER_CELLS]; /* the BG-to-OAM priority attribute, few games use it */
+    uint8_t color_id[TILE_MAP_SIZE][TILE_MAP_SIZE];
+    uint8_t color[TILE_MAP_SIZE][TILE_MAP_SIZE];
+    uint8_t priority[TILE_MAP_SIZE][TILE_MAP_SIZE];
+};
+
+/* see gbc_graphic_set_layer_cache(), allocated when it is turned on */
+struct gbc_layer_cache
+{
+    uint32_t tile_generation[TILE_CACHE_TILES];   /* bumped by every write to the tile */
+    gbc_layer_t map[2];
+};
+
+typedef struct gbc_obj_index gbc_obj_index_t;
+typedef struct gbc_line_regs gbc_line_regs_t;
+typedef struct gbc_graphic_worker gbc_graphic_worker_t;
+
+/*
+The objs of every visible scanline, in OAM order, at most MAX_OBJ_SCANLINE per line.
+It is rebuilt before a line is drawn if OAM or LCDC.2 changed since it was built.
+*/
+struct gbc_obj_index
+{
+    uint8_t obj_size;       /* LCDC_OBJ_SIZE when it was built */
+    uint8_t count[VISIBLE_VERTICAL_PIXELS];
+    uint8_t objs[VISIBLE_VERTICAL_PIXELS][MAX_OBJ_SCANLINE];
+};
+
+/* the registers a scanline is drawn with, read when mode 3 starts */
+struct gbc_line_regs
+{
+    uint8_t scanline;
+    uint8_t lcdc;
+    uint8_t scx;
+    uint8_t scy;
+    uint8_t wx;
+    uint8_t wy;
+    uint8_t bgp;            /* BGP, OBP0 and OBP1 are only used in DMG compatibility mode */
+    uint8_t obp0;
+    uint8_t obp1;
+    uint8_t window_line;    /* line of the window drawn here, WINDOW_LINE_NONE if it is not shown */
+    uint8_t x_from;         /* the pixels drawn with these registers, [x_from, x_to) */
+    uint8_t x_to;           /* a line is only cut in pieces by mid-line writes in PPU_ACCURACY_DOT */
+};
+
+#define WINDOW_LINE_NONE 0xFF
+
+/*
+How closely the PPU is followed, see gbc_graphic_set_accuracy().
+PPU_ACCURACY_DOT models what the pixel FIFO does to the timing and the picture, not every dot of it:
+- mode 3 is 172 to 289 dots, depending on SCX, the window and the objs, mode 0 gets the rest
+- the window has its own line counter, it only moves on lines the window is shown on
+- the window starts once LY == WY in a frame, WY changes afterwards don't hide it
+- writes to LCDC, SCX, SCY, WX, WY and the palettes during mode 3 change the rest of the line
+*/
+#define PPU_ACCURACY_SCANLINE 0   /* fixed mode lengths, a line is drawn at once, the fastest */
+#define PPU_ACCURACY_DOT      1   /* for timing sensitive games and test ROMs */
+#define PPU_ACCURACIES        2
+
+/*
+How scanlines are drawn, see gbc_graphic_set_render_mode(), the output is the same in every mode.
+Except in RENDER_MODE_LINE, mode 3 only queues the registers. In RENDER_MODE_CATCH_UP the queue is
+drained, gbc_graphic_sync(), before VRAM, OAM or the palettes change and before a frame is handed over.
+RENDER_MODE_THREAD only drains it before a frame is handed over, see gbc_graphic_snapshot.
+*/
+#define RENDER_MODE_LINE     0   /* a line is drawn when mode 3 starts */
+#define RENDER_MODE_CATCH_UP 1   /* lines are drawn in batches, when something they use is about to change */
+#define RENDER_MODE_THREAD   2   /* lines are drawn on a worker thread */
+
+#define WORKER_QUEUE_LINES 256   /* more than a frame */
+#define WORKER_BATCH_LINES 16
+#define WORKER_QUEUE_WRITES 4096
+
+typedef struct gbc_graphic_write gbc_graphic_write_t;
+typedef struct gbc_graphic_snapshot gbc_graphic_snapshot_t;
+
+/* RENDER_WRITE_* of memory.h, addr is the offset in VRAM, OAM or the host palette */
+struct gbc_graphic_write
+{
+    uint8_t target;
+    uint16_t addr;
+    uint32_t data;
+};
+
+/*
+What the worker draws from in RENDER_MODE_THREAD, its own copy of VRAM, OAM and the host palette.
+The emulation thread doesn't wait for the worker when it writes them, the write goes to the log and
+every queued line carries the log position it was queued at, its version. The worker replays the
+log up to that version before drawing the line. Writes that bypass the log(OAM DMA, save states)
+come after a gbc_graphic_sync(), the snapshot is then compared with the live state and updated
+when the next line is queued.
+*/
+struct gbc_graphic_snapshot
+{
+    uint8_t vram[VRAM_BANK_SIZE * 2];
+    uint8_t oam[OAM_END - OAM_BEGIN + 1];
+    uint8_t oam_dirty;
+    uint32_t host_palette[HOST_PALETTE_COLORS + 2];
+    gbc_graphic_write_t writes[WORKER_QUEUE_WRITES];
+};
+
+/* the queued lines, the thread is only used in RENDER_MODE_THREAD */
+struct gbc_graphic_worker
+{
+    uint8_t stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    uint32_t head;      /* next line to queue */
+    uint32_t tail;      /* next line to draw */
+    uint32_t drained;   /* head when the queue was last seen empty, emulation thread only */
+    gbc_line_regs_t lines[WORKER_QUEUE_LINES];
+    uint32_t line_writes[WORKER_QUEUE_LINES];   /* write_head when the line was queued */
+
+    gbc_graphic_snapshot_t *snapshot;   /* RENDER_MODE_THREAD only */
+    uint8_t snapshot_stale;             /* the live state changed behind the log, emulation thread only */
+    uint32_t write_head;    /* next write to log, emulation thread only */
+    uint32_t write_tail;    /* next write to replay */
+    uint32_t write_seen;    /* write_tail when a line was last queued, emulation thread only */
+};
+
+typedef struct gbc_frame_info gbc_frame_info_t;
+typedef struct gbc_frame_rect gbc_frame_rect_t;
+
+/* in pixels, from the top-left corner */
+struct gbc_frame_rect
+{
+    uint8_t x;
+    uint8_t y;
+    uint8_t width;
+    uint8_t height;
+};
+
+/* every other line dirty is the worst case */
+#define FRAME_MAX_RECTS ((VISIBLE_VERTICAL_PIXELS + 1) / 2)
+
+/*
+What changed in the frame handed to frame_ready, compared to the frame before it.
+Lines are compared by a 64-bit hash, frontends may skip uploading or encoding unchanged lines.
+The damage is also a list of rectangles, one per run of dirty lines, as wide as the changed pixels,
+found by comparing the dirty lines with the frame before.
+*/
+struct gbc_frame_info
+{
+    uint64_t hash;      /* of the whole frame */
+    uint8_t changed;    /* any line is dirty */
+    uint32_t dirty[(VISIBLE_VERTICAL_PIXELS + 31) / 32];   /* one bit per line */
+    uint8_t rect_count;
+    gbc_frame_rect_t rects[FRAME_MAX_RECTS];
+};
+
+#define FRAME_LINE_DIRTY(info, line) ((info)->dirty[(line) / 32] & (1u << ((line) % 32)))
+
 struct gbc_graphic
 {
     uint32_t dots;   /* dots to next graphic update */
     uint8_t vram[VRAM_BANK_SIZE * 2]; /* 2x8KB */
     uint8_t scanline;
     uint8_t mode;
+    gbc_tile_cache_t tile_cache;
+    /* what the lines are drawn from, the live state or worker.snapshot, see gbc_graphic_snapshot */
+    uint8_t *draw_vram;
+    uint8_t *draw_oam;
+    uint8_t *draw_oam_dirty;
+    const uint32_t *draw_palette;
+    gbc_layer_cache_t *layers;  /* NULL when the layer cache is off */
+    gbc_obj_index_t obj_index;
+    const gbc_simd_t *simd;     /* picked at init, see simd.h */
+
+    /* double buffered, framebuffer[front] is the last finished frame, 4 bytes per pixel at most */
+    uint32_t framebuffer[2][FRAMEBUFFER_PIXELS];
+    uint8_t front;
+    uint8_t front_format;   /* PIXEL_FORMATS before the first frame */
+    uint64_t line_hash[VISIBLE_VERTICAL_PIXELS];   /* of the lines drawn in the back buffer */
+    uint64_t front_line_hash[VISIBLE_VERTICAL_PIXELS];
+    uint32_t lines_drawn[(VISIBLE_VERTICAL_PIXELS + 31) / 32];
+    gbc_frame_info_t frame_info;
+
+    /* see FRAME_SKIP_* */
+    uint8_t frame_skip_mode;
+    uint8_t frame_skip;
+    uint8_t frame_skipped;      /* frames skipped in a row */
+    uint8_t skip_frame;         /* the current frame is not drawn */
+    uint8_t lcd_warmup;         /* the first frame after the LCD is turned on, not drawn either */
+    uint8_t host_late;          /* set by the frontend when the last frame took too long */
+
+    uint8_t frame_blend;        /* weight of the frame on screen, 0 is off */
+    uint8_t blend_format;       /* of the frame on screen, PIXEL_FORMATS if there is none to mix with */
 
     void *screen_udata;
     void (*screen_update)(void *udata);
-    screen_write screen_write;
+    frame_ready frame_ready;
+    line_ready line_ready;      /* called on the worker thread in RENDER_MODE_THREAD */
+    uint8_t render_mode;
+    gbc_graphic_worker_t worker;
+
+    /* picked once per cartridge by gbc_graphic_set_dmg_compat(), the CGB path doesn't check for DMG games */
+    uint8_t dmg_compat;
+    void (*draw_line)(gbc_graphic_t *graphic, const gbc_line_regs_t *regs);
+
+    /* see PPU_ACCURACY_*, the rest is only used in PPU_ACCURACY_DOT */
+    uint8_t accuracy;
+    uint16_t mode3_dots;        /* of the current line */
+    uint8_t window_wy;          /* LY was WY in this frame */
+    uint8_t window_line;        /* the window's own line counter */
+    uint8_t window_shown;       /* on the current line */
+    uint8_t line_pending;       /* the current line is drawn in pieces, the last one when mode 3 ends */
+    uint8_t line_stale;         /* a register was written since line_regs were read */
+    gbc_line_regs_t line_regs;  /* of the piece not drawn yet, it starts at x_from */
+
+    /* called when entering V-BLANK, NULL if nobody is interested */
+    void *vblank_udata;
+    void (*vblank)(void *udata);
 
     gbc_memory_t *mem;
 };
@@ -150,8 +413,44 @@ struct gbc_obj
 void gbc_graphic_connect(gbc_graphic_t *graphic, gbc_memory_t *mem);
 void gbc_graphic_init(gbc_graphic_t *graphic);
 void gbc_graphic_cycle(gbc_graphic_t *graphic);
+/*
+Runs the mode change that is due now, returns the cycles until the next one, also in graphic->dots.
+Nothing the CPU can see changes in between, the main loop only counts dots down and calls this when they run out.
+*/
+uint32_t gbc_graphic_event(gbc_graphic_t *graphic);
+/* about the frame last handed to frame_ready */
+const gbc_frame_info_t* gbc_graphic_frame_info(gbc_graphic_t *graphic);
+/* see RENDER_MODE_*, starts or stops the render thread */
+int gbc_graphic_set_render_mode(gbc_graphic_t *graphic, uint8_t mode);
+/* draws the queued scanlines, or waits for the render thread to */
+void gbc_graphic_sync(gbc_graphic_t *graphic);
+void gbc_graphic_set_frame_skip(gbc_graphic_t *graphic, uint8_t mode, uint8_t frames);
+/*
+DMG compatibility mode, for games without the CGB flag, the boot ROM picks the palettes.
+https://gbdev.io/pandocs/CGB_Registers.html#ff4c--key0sys-cgb-mode-only
+*/
+void gbc_graphic_set_dmg_compat(gbc_graphic_t *graphic, uint8_t enable);
+/*
+Draws BG and window lines from tilemaps kept pre-drawn, for games that scroll a mostly unchanged map.
+The output is the same, it costs 400KB. Not used for DMG games.
+*/
+int gbc_graphic_set_layer_cache(gbc_graphic_t *graphic, uint8_t enable);
+/* see PPU_ACCURACY_*, can be changed at any time */
+int gbc_graphic_set_accuracy(gbc_graphic_t *graphic, uint8_t accuracy);
+/* a line drawn in pieces by PPU_ACCURACY_DOT is drawn to the end at once */
+void gbc_graphic_finish_line(gbc_graphic_t *graphic);
+/*
+LCD ghosting, games that flicker objs for transparency need it. Every frame is mixed with the last
+one shown, weight / 256 of it, 0 turns it off. Not for PIXEL_FORMAT_INDEXED8.
+*/
+void gbc_graphic_set_frame_blend(gbc_graphic_t *graphic, uint8_t weight);
 uint8_t* gbc_graphic_get_tile_attr(gbc_graphic_t *graphic, uint8_t type, uint8_t idx);
 gbc_tile_t* gbc_graphic_get_tile(gbc_graphic_t *graphic, uint8_t type, uint8_t idx, uint8_t bank);
 
+/* the 64 color ids of a tile, row by row, tile is bank * TILES_PER_BANK + (addr - 0x8000) / 16 */
+const uint8_t* gbc_graphic_tile_pixels(gbc_graphic_t *graphic, uint16_t tile, uint8_t xflip);
+/* VRAM was changed behind vram_write()'s back, e.g. a state was loaded */
+void gbc_graphic_invalidate_tiles(gbc_graphic_t *graphic);
+
 
 #endif
\ No newline at end of file
@@ -35,11 +35,12 @@ void GuiAudioWrite(int8_t l_sample, int8_t r_sample);
 void GuiAudioUpdate(void *udata);
 
 /*
-pixels of Gameboy screen will be written using this function,
-addr is the position of the pixel, left-top is 0, right-bottom is 159x143
-data is the RGB555 color data
+it will be called once per frame with the finished Gameboy screen, 160x144 pixels,
+stride is the size of a row in bytes, format is one of PIXEL_FORMAT_*.
+The GUI keeps the default PIXEL_FORMAT_RGBA8888, R, G, B, A bytes, the layout of ImU32.
+The buffer is not copied, it stays valid until the next call.
 */
-void GuiWrite(void *udata, unsigned short addr, unsigned short data);
+void GuiFrameReady(void *udata, const void *buffer, uint16_t stride, uint8_t format);
 
 #ifdef __cplusplus
 }
@@ -60,8 +60,18 @@ static std::unordered_map<int, SDL_Keycode> key_map = {
     {SDLK_RIGHT, GBC_KEY_RIGHT},
 };
 
+#define REWIND_KEY SDLK_BACKSPACE
+
 void HandleKeyPress(SDL_Keycode key, int action)
 {
+    if (key == REWIND_KEY) {
+        // hold to rewind
+        gbc_t *gbc = (gbc_t*)gui_callback_udata;
+        if (gbc)
+            gbc->rewind.rewinding = action == SDL_KEYDOWN;
+        return;
+    }
+
     key_pressed = 0;
     auto kiter = key_map.find(key);
     if (kiter == key_map.end()) {
@@ -343,6 +353,30 @@ uint8_t GuiPollKeypad()
     return key_pressed;
 }
 
+// create the texture when texture is NULL or the size changed, then upload the RGBA pixels
+void *UploadTexture(void *texture, const void *pixels, int width, int height, bool resized) {
+    GLuint id = (GLuint)(intptr_t)texture;
+    if (!id) {
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        resized = true;
+    }
+    glBindTexture(GL_TEXTURE_2D, id);
+    if (resized)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    return (void*)(intptr_t)id;
+}
+
+// replace rows [y, y + rows) of the texture, pixels points at row y
+void UpdateTextureRows(void *texture, const void *pixels, int width, int y, int rows) {
+    glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, rows, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
 void GuiSetCloseCallback(void (*callback)(void* udata)) {
     gui_close_callback = callback;
 }
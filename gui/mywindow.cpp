@@ -1,59 +1,120 @@
 #include "mywindow.h"
 #include "gui.h"
+extern "C" {
+#include "state.h"
+#include "scale.h"
+}
 #include <imgui.h>
 #include <vector>
 #include <ctime>
 #include <string>
 #include <random>
+#include <thread>
+#include <algorithm>
 
 const int width = 160;
 const int height = 144;
 const int pixel_size = 4;
 const int tile_viewer_border_width = 1;
 static int tile_viewer_enabled = 0;
+static int cheats_enabled = 0;
+static std::vector<uint8_t> state_slot;
+static size_t state_slot_size = 0;
+static char cheat_input[CHEAT_CODE_SIZE] = "";
 
 const int tile_viewr_col = 16;
-const int tile_viewer_row = 384 / tile_viewr_col;
+const int tile_viewer_row = TILES_PER_BANK / tile_viewr_col;
 
 static double last_frame = 0;
 static long long int last_cycles = 0;
-std::vector<ImU32> framebuffer(width * height, IM_COL32(0, 0, 0, 255)); // Initialize with black color
-
+// the last finished frame, owned by the core until the next one arrives
+static const uint8_t *frame = NULL;
+static int frame_stride = 0;
+static bool frame_updated = false;
+// lines changed since the last upload, see gbc_frame_info_t
+static uint32_t frame_dirty[(height + 31) / 32];
+// the frame is scaled on the CPU, the GPU only draws the texture
+static gbc_scaler_t *scaler = NULL;
+static std::vector<uint32_t> scaled_frame;
+static void *frame_texture = NULL;
+static int scale_filter = 0;
+
+
+gbc_scaler_t *GetScaler() {
+    if (!scaler) {
+        scaler = new gbc_scaler_t;
+        gbc_scaler_init(scaler, std::min(4u, std::thread::hardware_concurrency()));
+        gbc_scaler_set_filter(scaler, SCALE_FILTER_NEAREST, pixel_size);
+    }
+    return scaler;
+}
 
 // Draw the framebuffer
-void DrawFramebuffer(ImDrawList* draw_list, const std::vector<ImU32>& buffer, ImVec2 position) {
+void DrawFramebuffer(ImDrawList* draw_list, ImVec2 position) {
+    if (!frame) {
+        draw_list->AddRectFilled(position, ImVec2(position.x + width * pixel_size, position.y + height * pixel_size),
+            IM_COL32(0, 0, 0, 255));
+        return;
+    }
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            ImVec2 p = ImVec2(x * pixel_size + position.x, y * pixel_size + position.y);
-            draw_list->AddRectFilled(p, ImVec2(p.x + pixel_size, p.y + pixel_size), buffer[y * width + x]);
+    if (frame_updated) {
+        gbc_scaler_t *scaler = GetScaler();
+        int factor = scaler->factor, w = SCALE_WIDTH(factor), h = SCALE_HEIGHT(factor);
+        bool resized = scaled_frame.size() != (size_t)(w * h);
+        scaled_frame.resize(w * h);
+        gbc_scale_frame(scaler, frame, frame_stride, PIXEL_FORMAT_RGBA8888, scaled_frame.data(), w * sizeof(uint32_t));
+
+        if (resized || !frame_texture) {
+            frame_texture = UploadTexture(frame_texture, scaled_frame.data(), w, h, resized);
+        } else {
+            // only the runs of dirty lines, Scale2x also changes the lines next to them
+            int margin = scaler->filter == SCALE_FILTER_SCALE2X ? 2 : 0;
+            for (int y = 0; y < height; y++) {
+                if (!(frame_dirty[y / 32] & (1u << (y % 32))))
+                    continue;
+                int end = y;
+                while (end < height && (frame_dirty[end / 32] & (1u << (end % 32))))
+                    end++;
+                int first = std::max(0, y - margin), last = std::min(height, end + margin);
+                UpdateTextureRows(frame_texture, scaled_frame.data() + first * factor * w, w,
+                    first * factor, (last - first) * factor);
+                y = end;
+            }
         }
+        memset(frame_dirty, 0, sizeof(frame_dirty));
+        frame_updated = false;
+    }
+    draw_list->AddImage((ImTextureID)frame_texture, position,
+        ImVec2(position.x + width * pixel_size, position.y + height * pixel_size));
+}
+
+void SetScaleFilter(int filter) {
+    // nearest, Scale2x and Scale4x, the GPU stretches the rest of the way
+    static const uint8_t filters[][2] = {
+        {SCALE_FILTER_NEAREST, pixel_size}, {SCALE_FILTER_SCALE2X, 2}, {SCALE_FILTER_SCALE2X, 4}
+    };
+    if (gbc_scaler_set_filter(GetScaler(), filters[filter][0], filters[filter][1]) == 0) {
+        scale_filter = filter;
+        frame_updated = frame != NULL;
+        memset(frame_dirty, 0xff, sizeof(frame_dirty));
     }
 }
 
 void DrawTileViewerFramebuffer(ImDrawList* draw_list, int bank, ImVec2 position) {
     // Draw the tile viewer framebuffer
     gbc_t *gbc = (gbc_t*)gui_callback_udata;
+    // the tile cache belongs to the render thread until it is idle
+    gbc_graphic_sync(&gbc->graphic);
     for (int row = 0; row < tile_viewer_row; row++) {
         for (int col = 0; col < tile_viewr_col; col++) {
             int idx = row * tile_viewr_col + col;
-            gbc_tile_t *tile;
-            if (idx > 255) {
-                uint8_t old = IO_PORT_READ(&gbc->mem, IO_PORT_LCDC);
-                IO_PORT_WRITE(&gbc->mem, IO_PORT_LCDC, old & ~LCDC_BG_WINDOW_TILE_DATA);
-                tile = gbc_graphic_get_tile(&gbc->graphic, TILE_TYPE_WIN, idx, bank);
-                IO_PORT_WRITE(&gbc->mem, IO_PORT_LCDC, old);
-            } else {
-                tile = gbc_graphic_get_tile(&gbc->graphic, TILE_TYPE_OBJ, idx, bank);
-            }
-            /* debug rom */
-            // tile = (gbc_tile_t*)((gbc->mbc.rom_banks)+(0x4000 * rom_counter + 0x1800 + idx * 16));
+            const uint8_t *pixels = gbc_graphic_tile_pixels(&gbc->graphic, bank * TILES_PER_BANK + idx, 0);
 
             int row_base = row * (8 + tile_viewer_border_width) * pixel_size + position.y + tile_viewer_border_width / 2 * pixel_size;
             int col_base = col * (8 + tile_viewer_border_width) * pixel_size + position.x + tile_viewer_border_width / 2 * pixel_size;
             for (int y = 0; y < 8; y++) {
                 for (int x = 0; x < 8; x++) {
-                    uint8_t color_id = TILE_PIXEL_COLORID(tile, x, y);
+                    uint8_t color_id = pixels[y * 8 + x];
 
                     ImU32 color;
                     if (color_id == 0) {
@@ -85,8 +146,19 @@ void InitMyWindow() {
     std::srand(std::time(nullptr));
 }
 
-void GuiWrite(void *udata, unsigned short addr, unsigned short data) {
-    framebuffer[addr] = IM_COL32(GBC_COLOR_TO_RGB_R(data), GBC_COLOR_TO_RGB_G(data), GBC_COLOR_TO_RGB_B(data), 255);
+void GuiFrameReady(void *udata, const void *buffer, uint16_t stride, uint8_t format) {
+    // DrawFramebuffer() reads ImU32 pixels
+    if (format != PIXEL_FORMAT_RGBA8888)
+        return;
+    frame = (const uint8_t*)buffer;
+    frame_stride = stride;
+
+    // the texture already has the unchanged lines, they add up until the next upload
+    gbc_t *gbc = (gbc_t*)gui_callback_udata;
+    const gbc_frame_info_t *info = gbc_graphic_frame_info(&gbc->graphic);
+    for (int i = 0; i < IM_ARRAYSIZE(frame_dirty); i++)
+        frame_dirty[i] |= info->dirty[i];
+    frame_updated |= info->changed != 0;
 }
 
 bool IsPaused() {
@@ -114,6 +186,61 @@ void VisualizeTiles() {
     ImGui::End();
 }
 
+void ShowCheats() {
+    gbc_t *gbc = (gbc_t*)gui_callback_udata;
+    gbc_cheat_t *cheat = &gbc->cheat;
+
+    ImGui::SetNextWindowSize(ImVec2(400, 400), ImGuiCond_FirstUseEver);
+    ImGui::Begin("Cheats");
+    ImGui::Text("GameShark: 01VVLLHH, Game Genie: ABC-DEF-GHI");
+    ImGui::InputText("##code", cheat_input, sizeof(cheat_input));
+    ImGui::SameLine();
+    if (ImGui::Button("Add") && gbc_cheat_add(cheat, cheat_input, 1) == 0) {
+        cheat_input[0] = '\0';
+    }
+
+    ImGui::Separator();
+    for (int i = 0; i < cheat->count; i++) {
+        ImGui::PushID(i);
+        bool enabled = cheat->codes[i].enabled;
+        if (ImGui::Checkbox(cheat->codes[i].code, &enabled)) {
+            gbc_cheat_enable(cheat, i, enabled);
+        }
+        ImGui::SameLine();
+        if (ImGui::SmallButton("Remove")) {
+            gbc_cheat_remove(cheat, i);
+        }
+        ImGui::PopID();
+    }
+
+    ImGui::Separator();
+    if (ImGui::Button("Save")) {
+        gbc_cheat_save(cheat);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Reload")) {
+        gbc_cheat_load(cheat);
+    }
+    ImGui::End();
+}
+
+void ClickSaveState() {
+    gbc_t *gbc = (gbc_t*)gui_callback_udata;
+    state_slot.resize(gbc_state_size(gbc));
+    state_slot_size = gbc_state_save(gbc, state_slot.data(), state_slot.size());
+}
+
+void ClickLoadState() {
+    gbc_t *gbc = (gbc_t*)gui_callback_udata;
+    if (state_slot_size)
+        gbc_state_load(gbc, state_slot.data(), state_slot_size);
+}
+
+void SetRewinding(bool rewinding) {
+    gbc_t *gbc = (gbc_t*)gui_callback_udata;
+    gbc->rewind.rewinding = rewinding;
+}
+
 void ClickPause() {
     gbc_t *gbc = (gbc_t*)gui_callback_udata;
     if (gbc->paused) {
@@ -130,7 +257,7 @@ void ClickStep() {
 }
 
 void ShowHUDControlPanels() {
-        ImGui::BeginChild("Control", ImVec2(300, 50), true);
+        ImGui::BeginChild("Control", ImVec2(300, 270), true);
         std::string pause_text = IsPaused() ? "Resume" : "Pause";
         if (ImGui::Button(pause_text.c_str())) {
             ClickPause();
@@ -148,9 +275,94 @@ void ShowHUDControlPanels() {
             tile_viewer_enabled = !tile_viewer_enabled;
         }
 
+        ImGui::SameLine();
+        ImGui::Button("Rewind");
+        // hold to rewind, like the backspace key
+        if (ImGui::IsItemActivated()) {
+            SetRewinding(true);
+        } else if (ImGui::IsItemDeactivated()) {
+            SetRewinding(false);
+        }
+
         if (tile_viewer_enabled) {
             VisualizeTiles();
         }
+
+        if (ImGui::Button("Save State")) {
+            ClickSaveState();
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("Load State")) {
+            ClickLoadState();
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button(cheats_enabled ? "Hide Cheats" : "Cheats")) {
+            cheats_enabled = !cheats_enabled;
+        }
+
+        if (cheats_enabled) {
+            ShowCheats();
+        }
+
+        gbc_t *gbc = (gbc_t*)gui_callback_udata;
+        // COLOR_PROFILE_NONE, COLOR_PROFILE_CGB_LCD, COLOR_PROFILE_GBA_SP
+        static const char *color_profiles[] = {"None", "GBC LCD", "GBA-SP"};
+        int color_profile = gbc->mem.color_profile;
+        ImGui::SetNextItemWidth(150);
+        if (ImGui::Combo("Colors", &color_profile, color_profiles, IM_ARRAYSIZE(color_profiles))) {
+            gbc_mem_set_color_profile(&gbc->mem, color_profile);
+        }
+
+        static const char *scale_filters[] = {"Nearest", "Scale2x", "Scale4x"};
+        int filter = scale_filter;
+        ImGui::SetNextItemWidth(150);
+        if (ImGui::Combo("Filter", &filter, scale_filters, IM_ARRAYSIZE(scale_filters))) {
+            SetScaleFilter(filter);
+        }
+
+        // weight of the last frame shown, 0 is off
+        int frame_blend = gbc->graphic.frame_blend;
+        ImGui::SetNextItemWidth(150);
+        if (ImGui::SliderInt("Ghosting", &frame_blend, 0, 192)) {
+            gbc_graphic_set_frame_blend(&gbc->graphic, frame_blend);
+        }
+
+        // RENDER_MODE_LINE, RENDER_MODE_CATCH_UP, RENDER_MODE_THREAD
+        static const char *render_modes[] = {"Per Line", "Catch-up", "Render Thread"};
+        int render_mode = gbc->graphic.render_mode;
+        ImGui::SetNextItemWidth(150);
+        if (ImGui::Combo("Rendering", &render_mode, render_modes, IM_ARRAYSIZE(render_modes))) {
+            gbc_graphic_set_render_mode(&gbc->graphic, render_mode);
+        }
+
+        // PPU_ACCURACY_SCANLINE, PPU_ACCURACY_DOT
+        static const char *accuracies[] = {"Scanline", "Dot"};
+        int accuracy = gbc->graphic.accuracy;
+        ImGui::SetNextItemWidth(150);
+        if (ImGui::Combo("PPU", &accuracy, accuracies, IM_ARRAYSIZE(accuracies))) {
+            gbc_graphic_set_accuracy(&gbc->graphic, accuracy);
+        }
+
+        // BG and window lines copied from pre-drawn tilemaps, same output
+        bool layer_cache = gbc->graphic.layers != NULL;
+        if (ImGui::Checkbox("Layer Cache", &layer_cache)) {
+            gbc_graphic_set_layer_cache(&gbc->graphic, layer_cache);
+        }
+
+        // off, fixed and adaptive, FRAME_SKIP_ALL is for headless runs
+        static const char *frame_skip_modes[] = {"Off", "Fixed", "Adaptive"};
+        int frame_skip_mode = gbc->graphic.frame_skip_mode;
+        int frame_skip = gbc->graphic.frame_skip;
+        ImGui::SetNextItemWidth(100);
+        bool changed = ImGui::Combo("##frameskip", &frame_skip_mode, frame_skip_modes, IM_ARRAYSIZE(frame_skip_modes));
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        changed |= ImGui::SliderInt("Frame Skip", &frame_skip, 1, 9);
+        if (changed) {
+            gbc_graphic_set_frame_skip(&gbc->graphic, frame_skip_mode, frame_skip);
+        }
 /*         ImGui::SameLine();
         if (ImGui::Button("Button 3")) {}  */
         ImGui::EndChild();
@@ -190,6 +402,10 @@ void ShowHUDStatus() {
         ImGui::SameLine();
         ImGui::Text("%.2f", fps);
 
+        ImGui::Text("rewind: ");
+        ImGui::SameLine();
+        ImGui::Text("%u snapshots, %zuKB", gbc_rewind_count(&gbc->rewind), gbc_rewind_used(&gbc->rewind) / 1024);
+
         ImGui::Separator(); // Optional separator line
 
         if (ImGui::BeginTable("REG", 4))
@@ -227,7 +443,7 @@ void ShowGame() {
     ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
     ImGui::Begin("GBC");
     ImDrawList* draw_list = ImGui::GetWindowDrawList();
-    DrawFramebuffer(draw_list, framebuffer, ImGui::GetCursorScreenPos());
+    DrawFramebuffer(draw_list, ImGui::GetCursorScreenPos());
     ImGui::End();
     ImGui::PopStyleVar();
 }
@@ -1,4 +1,8 @@
 #pragma once 
 
 void ShowMyWindow();
-void InitMyWindow();
\ No newline at end of file
+void InitMyWindow();
+
+// see main_sdl2.cpp, returns the ImTextureID
+void *UploadTexture(void *texture, const void *pixels, int width, int height, bool resized);
+void UpdateTextureRows(void *texture, const void *pixels, int width, int y, int rows);
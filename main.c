@@ -12,7 +12,7 @@
 
 #define USEAGE "Usage: xgbc -r cartridge [-b boot_rom]\n" \
                 "  cartridge: path to the gameboy cartridge file\n" \
-                "  boot_rom(optional): path to the boot rom\n"
+                "  boot_rom(optional): path to the boot rom, without it the post-boot state is synthesised(see boot.h)\n"
 
 static void
 parse_args(int argc, char **argv, char **cartridge, char **boot_rom)
@@ -76,12 +76,14 @@ main(int argc, char **argv)
     while (RomDialog(&cartridge, &boot_rom))
         ;
 
-    gbc_t gbc;
+    static gbc_t gbc;
     if (gbc_init(&gbc, cartridge, boot_rom) == 0) {
+        /* rewind is optional, the emulator runs without it */
+        gbc_rewind_init(&gbc.rewind, &gbc, REWIND_DEFAULT_BUDGET, REWIND_DEFAULT_INTERVAL);
         GuiSetCloseCallback(close_callback);
         GuiSetUserData(&gbc);
         gbc.io.poll_keypad = GuiPollKeypad;
-        gbc.graphic.screen_write = GuiWrite;
+        gbc.graphic.frame_ready = GuiFrameReady;
         gbc.graphic.screen_update = GuiUpdate;
         gbc.audio.audio_write = GuiAudioWrite;
         gbc.audio.audio_update = GuiAudioUpdate;
@@ -153,6 +153,20 @@ io_port_read(void *udata, uint16_t addr)
     return IO_PORT_READ(mem, port);
 }
 
+static inline void
+render_sync(gbc_memory_t *mem)
+{
+    if (mem->render_sync)
+        mem->render_sync(mem->render_sync_udata);
+}
+
+static inline void
+render_write(gbc_memory_t *mem, uint8_t target, uint16_t addr, uint32_t data)
+{
+    if (mem->render_write)
+        mem->render_write(mem->render_sync_udata, target, addr, data);
+}
+
 static inline uint8_t
 oam_read(void *udata, uint16_t addr)
 {
@@ -164,7 +178,9 @@ oam_write(void *udata, uint16_t addr, uint8_t data)
 {
     // LOG_DEBUG("[MEM] Writing to OAM %x [%x]\n", addr, data);
     gbc_memory_t *mem = (gbc_memory_t*)udata;
+    render_write(mem, RENDER_WRITE_OAM, addr - OAM_BEGIN, data);
     mem->oam[addr - OAM_BEGIN] = data;
+    mem->oam_dirty = 1;
     return data;
 }
 
@@ -172,9 +188,11 @@ static inline void
 io_dma_transer(gbc_memory_t *mem, uint8_t addr)
 {
     uint16_t src = addr << 8;
+    render_sync(mem);
     for (uint16_t dst = OAM_BEGIN; dst <= OAM_END; dst++, src++) {
         mem->oam[dst-OAM_BEGIN] = mem->read(mem, src);
     }
+    mem->oam_dirty = 1;
 }
 
 static inline uint8_t
@@ -196,6 +214,129 @@ hdma_transer(gbc_memory_t *mem, uint8_t data)
     return 0xff;
 }
 
+static inline uint32_t
+host_pixel(uint8_t format, uint32_t r, uint32_t g, uint32_t b, uint8_t idx)
+{
+    switch (format) {
+    case PIXEL_FORMAT_BGRA8888:
+        return HOST_COLOR_BGRA(r, g, b);
+    case PIXEL_FORMAT_RGB565:
+        return HOST_COLOR_RGB565(r, g, b);
+    case PIXEL_FORMAT_INDEXED8:
+        return idx;
+    case PIXEL_FORMAT_GRAY8:
+        return HOST_COLOR_GRAY(r, g, b);
+    }
+    return HOST_COLOR(r, g, b);
+}
+
+/*
+Every RGB555 color to HOST_COLOR() for each profile, built the first time a profile is used.
+The tables are shared by all the emulators of the process, a palette write is one lookup.
+*/
+static uint32_t color_lut[COLOR_PROFILES][0x8000];
+static uint8_t color_lut_ready[COLOR_PROFILES];
+
+static uint32_t
+color_none(uint32_t r, uint32_t g, uint32_t b)
+{
+    return HOST_COLOR(r * 0xff / 0x1f, g * 0xff / 0x1f, b * 0xff / 0x1f);
+}
+
+/*
+The LCD of the GBC is far less saturated than a PC monitor, the colors bleed into each other,
+the curve is the one from higan.
+*/
+static uint32_t
+color_cgb_lcd(uint32_t r, uint32_t g, uint32_t b)
+{
+    uint32_t cr = r * 26 + g * 4 + b * 2;
+    uint32_t cg = g * 24 + b * 8;
+    uint32_t cb = r * 6 + g * 4 + b * 22;
+    return HOST_COLOR((cr < 960 ? cr : 960) >> 2, (cg < 960 ? cg : 960) >> 2, (cb < 960 ? cb : 960) >> 2);
+}
+
+/* the backlit screen of the GBA-SP, brighter than the GBC and only slightly mixed, every row sums to 32 */
+static uint32_t
+color_gba_sp(uint32_t r, uint32_t g, uint32_t b)
+{
+    uint32_t cr = r * 28 + g * 3 + b * 1;
+    uint32_t cg = r * 1 + g * 29 + b * 2;
+    uint32_t cb = r * 1 + g * 3 + b * 28;
+    return HOST_COLOR(cr * 0xff / (0x1f * 32), cg * 0xff / (0x1f * 32), cb * 0xff / (0x1f * 32));
+}
+
+static void
+color_lut_build(uint8_t profile)
+{
+    static uint32_t (*const convert[COLOR_PROFILES])(uint32_t, uint32_t, uint32_t) = {
+        color_none, color_cgb_lcd, color_gba_sp
+    };
+
+    if (color_lut_ready[profile])
+        return;
+    for (uint32_t color = 0; color < 0x8000; color++)
+        color_lut[profile][color] = convert[profile](color & 0x1f, (color >> 5) & 0x1f, (color >> 10) & 0x1f);
+    color_lut_ready[profile] = 1;
+}
+
+static inline void
+palette_update_host(gbc_memory_t *mem, uint8_t idx)
+{
+    const uint16_t *colors = idx < HOST_PALETTE_OBJ(0, 0) ?
+        mem->bg_palette[idx / 4].c : mem->obj_palette[(idx - HOST_PALETTE_OBJ(0, 0)) / 4].c;
+    uint32_t color = color_lut[mem->color_profile][colors[idx % 4] & 0x7fff];
+
+    if (mem->pixel_format != PIXEL_FORMAT_RGBA8888)
+        color = host_pixel(mem->pixel_format, color & 0xff, (color >> 8) & 0xff, (color >> 16) & 0xff, idx);
+    render_write(mem, RENDER_WRITE_PALETTE, idx, color);
+    mem->host_palette[idx] = color;
+}
+
+void
+gbc_mem_palette_refresh(gbc_memory_t *mem)
+{
+    render_sync(mem);
+    for (int i = 0; i < HOST_PALETTE_COLORS; i++)
+        palette_update_host(mem, i);
+    mem->host_palette[HOST_PALETTE_BLANK] = host_pixel(mem->pixel_format, 0, 0, 0, HOST_PALETTE_BLANK);
+    mem->host_palette[HOST_PALETTE_OFF] = host_pixel(mem->pixel_format, 0xff, 0xff, 0xff, HOST_PALETTE_OFF);
+}
+
+void
+gbc_mem_set_pixel_format(gbc_memory_t *mem, uint8_t format)
+{
+    if (format >= PIXEL_FORMATS) {
+        LOG_ERROR("[MEM] Invalid pixel format %d\n", format);
+        return;
+    }
+    mem->pixel_format_next = format;
+}
+
+uint8_t
+gbc_mem_pixel_format_apply(gbc_memory_t *mem)
+{
+    if (mem->pixel_format_next == mem->pixel_format)
+        return 0;
+    /* the lines queued so far are drawn in the old format */
+    render_sync(mem);
+    mem->pixel_format = mem->pixel_format_next;
+    gbc_mem_palette_refresh(mem);
+    return 1;
+}
+
+void
+gbc_mem_set_color_profile(gbc_memory_t *mem, uint8_t profile)
+{
+    if (profile >= COLOR_PROFILES) {
+        LOG_ERROR("[MEM] Invalid color profile %d\n", profile);
+        return;
+    }
+    color_lut_build(profile);
+    mem->color_profile = profile;
+    gbc_mem_palette_refresh(mem);
+}
+
 static uint8_t
 io_port_write(void *udata, uint16_t addr, uint8_t data)
 {
@@ -204,6 +345,7 @@ io_port_write(void *udata, uint16_t addr, uint8_t data)
     uint8_t port = IO_ADDR_PORT(addr);
 
     gbc_memory_t *mem = (gbc_memory_t*)udata;
+    uint8_t lcd_switched = 0;
 
     #if LOGLEVEL == LOG_LEVEL_DEBUG
     if (port == IO_PORT_TAC) {
@@ -219,6 +361,12 @@ io_port_write(void *udata, uint16_t addr, uint8_t data)
     }
     #endif
 
+    /* the part of the line drawn so far keeps the old value */
+    if (mem->ppu_write && (port == IO_PORT_LCDC || port == IO_PORT_SCY || port == IO_PORT_SCX ||
+        port == IO_PORT_WY || port == IO_PORT_WX || port == IO_PORT_BCPD_BGPD || port == IO_PORT_OCPD_OBPD ||
+        port == IO_PORT_BGP || port == IO_PORT_OBP0 || port == IO_PORT_OBP1))
+        mem->ppu_write(mem->ppu_write_udata);
+
     if (port == IO_PORT_DIV) {
         /* Writing to DIV resets it */
         data = 0;
@@ -240,6 +388,7 @@ io_port_write(void *udata, uint16_t addr, uint8_t data)
     } else if (port == IO_PORT_BCPD_BGPD) {
         uint8_t bcps = IO_PORT_READ(mem, IO_PORT_BCPS_BCPI);
         ((uint8_t*)mem->bg_palette)[bcps & 0x3f] = data;
+        palette_update_host(mem, HOST_PALETTE_BG(0, 0) + (bcps & 0x3f) / 2);
         if (bcps & 0x80) {
             /* auto increment */
             bcps = (bcps + 1) & 0x3f | 0x80;
@@ -248,6 +397,7 @@ io_port_write(void *udata, uint16_t addr, uint8_t data)
     } else if (port == IO_PORT_OCPD_OBPD) {
         uint8_t ocps = IO_PORT_READ(mem, IO_PORT_OCPS_OCPI);
         ((uint8_t*)mem->obj_palette)[ocps & 0x3f] = data;
+        palette_update_host(mem, HOST_PALETTE_OBJ(0, 0) + (ocps & 0x3f) / 2);
         if (ocps & 0x80) {
             /* auto increment */
             ocps = (ocps + 1) & 0x3f | 0x80;
@@ -256,12 +406,16 @@ io_port_write(void *udata, uint16_t addr, uint8_t data)
     } else if (port == IO_PORT_DMA) {
         io_dma_transer(mem, data);
     } else if (port == IO_PORT_VBK) {
-        data &= 0x01;
+        data &= mem->dmg_compat ? 0x00 : 0x01;
     } else if (port == IO_PORT_HDMA5) {
         data = hdma_transer(mem, data);
+    } else if (port == IO_PORT_LCDC) {
+        lcd_switched = (IO_PORT_READ(mem, IO_PORT_LCDC) ^ data) & LCDC_PPU_ENABLE;
     }
 
     IO_PORT_WRITE(mem, port, data);
+    if (lcd_switched && mem->lcd_switch)
+        mem->lcd_switch(mem->lcd_switch_udata, data & LCDC_PPU_ENABLE);
     return data;
 }
 
@@ -328,6 +482,9 @@ void
 gbc_mem_init(gbc_memory_t *mem)
 {
     memset(mem, 0, sizeof(gbc_memory_t));
+    color_lut_build(COLOR_PROFILE_NONE);
+    gbc_mem_palette_refresh(mem);
+    mem->oam_dirty = 1;
 
     mem->write = mem_write;
     mem->read = mem_read;
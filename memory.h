@@ -114,6 +114,7 @@
 #define IO_PORT_OBP1 0x49
 #define IO_PORT_WY   0x4a
 #define IO_PORT_WX   0x4b
+#define IO_PORT_KEY0 0x4c
 #define IO_PORT_KEY1 0x4d
 #define IO_PORT_VBK  0x4f
 #define IO_PORT_DISABLE_BOOT_ROM 0x50
@@ -143,7 +144,44 @@
 #define BG_PALETTE_READ(mem, idx) ((mem)->bg_palette + ((idx)))
 #define OBJ_PALETTE_READ(mem, idx) ((mem)->obj_palette + ((idx)))
 
+/*
+bg_palette and obj_palette converted to host pixels, BG colors first.
+The pixels are in mem->pixel_format, see gbc_mem_set_pixel_format().
+*/
+#define HOST_PALETTE_COLORS 64
+#define HOST_PALETTE_BG(palette, color_id) ((palette) * 4 + (color_id))
+#define HOST_PALETTE_OBJ(palette, color_id) (32 + (palette) * 4 + (color_id))
+#define HOST_PALETTE_BLANK HOST_PALETTE_COLORS    /* black, where nothing is drawn */
+#define HOST_PALETTE_OFF (HOST_PALETTE_COLORS + 1) /* white, the LCD is off */
+
+/* color correction, the colors of a game as they looked on the real screen */
+#define COLOR_PROFILE_NONE    0     /* RGB555 stretched to RGB888 */
+#define COLOR_PROFILE_CGB_LCD 1
+#define COLOR_PROFILE_GBA_SP  2
+#define COLOR_PROFILES        3
+
+/* the formats are named by the order of the bytes in memory */
+#define PIXEL_FORMAT_RGBA8888 0     /* the layout of ImU32, the default */
+#define PIXEL_FORMAT_BGRA8888 1
+#define PIXEL_FORMAT_RGB565   2     /* a native endian uint16_t */
+#define PIXEL_FORMAT_INDEXED8 3     /* the host palette index, the colors are in bg_palette/obj_palette */
+#define PIXEL_FORMAT_GRAY8    4
+#define PIXEL_FORMATS         5
+
+#define PIXEL_FORMAT_BYTES(format) ((format) <= PIXEL_FORMAT_BGRA8888 ? 4 : (format) == PIXEL_FORMAT_RGB565 ? 2 : 1)
+
+#define HOST_COLOR(r, g, b) (0xff000000u | (uint32_t)(b) << 16 | (uint32_t)(g) << 8 | (uint32_t)(r))
+#define HOST_COLOR_BGRA(r, g, b) (0xff000000u | (uint32_t)(r) << 16 | (uint32_t)(g) << 8 | (uint32_t)(b))
+#define HOST_COLOR_RGB565(r, g, b) (((uint32_t)(r) >> 3) << 11 | ((uint32_t)(g) >> 2) << 5 | (uint32_t)(b) >> 3)
+#define HOST_COLOR_GRAY(r, g, b) (((uint32_t)(r) * 77 + (uint32_t)(g) * 150 + (uint32_t)(b) * 29) >> 8)
+
 #define OAM_ADDR(mem) ((mem)->oam)
+
+/* what render_write changes */
+#define RENDER_WRITE_VRAM    0
+#define RENDER_WRITE_OAM     1
+#define RENDER_WRITE_PALETTE 2
+
 #define GBC_BOOT_ROM_SIZE 0x8ff /* it is 2KB plus the hole in the middle */
 
 typedef struct gbc_memory gbc_memory_t;
@@ -180,10 +218,30 @@ struct gbc_memory
       now there is a hole(audio registers) in the middle of io ports */
     uint8_t io_ports[IO_PORT_END_2 - IO_PORT_BEGIN + 1];
     uint8_t oam[OAM_END - OAM_BEGIN + 1];
+    uint8_t oam_dirty;  /* set by OAM writes and DMA, the graphic module clears it */
+
+    /* called before OAM or the palettes change, a scanline may still be drawn from them */
+    void *render_sync_udata;
+    void (*render_sync)(void *udata);
+    /* called instead of render_sync before a single OAM byte or host palette color changes to data */
+    void (*render_write)(void *udata, uint8_t target, uint16_t addr, uint32_t data);
+    /* LCDC.7 was flipped */
+    void *lcd_switch_udata;
+    void (*lcd_switch)(void *udata, uint8_t enable);
+    /* called before a register a scanline is drawn from changes, only set while lines are drawn in pieces */
+    void *ppu_write_udata;
+    void (*ppu_write)(void *udata);
     /* https://gbdev.io/pandocs/Palettes.html#lcd-color-palettes-cgb-only */
     /* palatte memory */
     gbc_palette_t bg_palette[8];
     gbc_palette_t obj_palette[8];
+    /* updated on every palette write, the renderer only looks colors up */
+    uint32_t host_palette[HOST_PALETTE_COLORS + 2];
+    uint8_t color_profile;
+    uint8_t pixel_format;
+    uint8_t pixel_format_next;  /* set by gbc_mem_set_pixel_format(), the renderer applies it between two frames */
+
+    uint8_t dmg_compat;     /* a DMG game, there is no VRAM bank 1 */
 
     uint8_t boot_rom_enabled;
     uint8_t boot_rom[GBC_BOOT_ROM_SIZE];
@@ -193,4 +251,16 @@ void gbc_mem_init(gbc_memory_t *mem);
 void register_memory_map(gbc_memory_t *mem, memory_map_entry_t *entry);
 void* connect_io_port(gbc_memory_t *mem, uint16_t addr);
 
+/* converts every palette color again, after a state load or a color correction change */
+void gbc_mem_palette_refresh(gbc_memory_t *mem);
+/* how the RGB555 colors look, see COLOR_PROFILE_* */
+void gbc_mem_set_color_profile(gbc_memory_t *mem, uint8_t profile);
+/*
+The renderer writes this format, see PIXEL_FORMAT_*.
+It is used from the next frame on, the frame being drawn is finished in the old one.
+*/
+void gbc_mem_set_pixel_format(gbc_memory_t *mem, uint8_t format);
+/* switches to the format given to gbc_mem_set_pixel_format(), returns 1 if it changed */
+uint8_t gbc_mem_pixel_format_apply(gbc_memory_t *mem);
+
 #endif
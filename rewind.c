@@ -0,0 +1,243 @@
+#include "rewind.h"
+#include "compress.h"
+#include "state.h"
+
+static gbc_rewind_snapshot_t *
+rewind_snapshot(gbc_rewind_t *rewind, uint32_t i)
+{
+    return &rewind->snapshots[(rewind->first + i) % REWIND_MAX_SNAPSHOTS];
+}
+
+/* drop the oldest keyframe and the deltas made against it */
+static void
+rewind_drop_oldest(gbc_rewind_t *rewind)
+{
+    do {
+        if (rewind_snapshot(rewind, 0)->serial == rewind->keyframe_serial)
+            rewind->keyframe_valid = 0;
+        rewind->first = (rewind->first + 1) % REWIND_MAX_SNAPSHOTS;
+        rewind->count--;
+    } while (rewind->count && !rewind_snapshot(rewind, 0)->keyframe);
+
+    if (!rewind->count)
+        rewind->head = 0;
+}
+
+/*
+The ring is used in order, a snapshot that doesn't fit before the end goes to the beginning.
+Drops the oldest snapshots until there is room.
+*/
+static int
+rewind_reserve(gbc_rewind_t *rewind, size_t size, size_t *offset)
+{
+    if (size > rewind->ring_size)
+        return 1;
+
+    for (;;) {
+        if (!rewind->count) {
+            *offset = rewind->head = 0;
+            return 0;
+        }
+
+        size_t tail = rewind_snapshot(rewind, 0)->offset;
+        if (rewind->head > tail) {
+            if (rewind->ring_size - rewind->head >= size) {
+                *offset = rewind->head;
+                return 0;
+            }
+            if (tail >= size) {
+                *offset = 0;
+                return 0;
+            }
+        } else if (rewind->head < tail && tail - rewind->head >= size) {
+            *offset = rewind->head;
+            return 0;
+        }
+
+        rewind_drop_oldest(rewind);
+    }
+}
+
+int
+gbc_rewind_init(gbc_rewind_t *rewind, struct gbc *gbc, size_t budget, uint16_t interval)
+{
+    memset(rewind, 0, sizeof(gbc_rewind_t));
+    rewind->gbc = gbc;
+    rewind->interval = interval ? interval : 1;
+    rewind->state_size = gbc_state_size(gbc);
+
+    size_t bound = COMPRESS_BOUND(rewind->state_size);
+    size_t fixed = REWIND_MAX_SNAPSHOTS * sizeof(gbc_rewind_snapshot_t) + rewind->state_size * 2 + bound;
+    /* room for at least a keyframe and a delta */
+    if (budget < fixed + bound * 2) {
+        LOG_ERROR("[REWIND] Budget too small: %zu, need at least %zu\n", budget, fixed + bound * 2);
+        return 1;
+    }
+    rewind->ring_size = budget - fixed;
+
+    rewind->snapshots = (gbc_rewind_snapshot_t*)malloc_memory(REWIND_MAX_SNAPSHOTS * sizeof(gbc_rewind_snapshot_t));
+    rewind->keyframe = (uint8_t*)malloc_memory(rewind->state_size);
+    rewind->state = (uint8_t*)malloc_memory(rewind->state_size);
+    rewind->compressed = (uint8_t*)malloc_memory(bound);
+    rewind->ring = (uint8_t*)malloc_memory(rewind->ring_size);
+
+    if (!rewind->snapshots || !rewind->keyframe || !rewind->state || !rewind->compressed || !rewind->ring) {
+        LOG_ERROR("[REWIND] Failed to allocate memory\n");
+        gbc_rewind_destroy(rewind);
+        return 1;
+    }
+
+    rewind->enabled = 1;
+    LOG_INFO("[REWIND] %zu bytes ring, state %zu bytes\n", rewind->ring_size, rewind->state_size);
+    return 0;
+}
+
+void
+gbc_rewind_destroy(gbc_rewind_t *rewind)
+{
+    free_memory(rewind->snapshots);
+    free_memory(rewind->keyframe);
+    free_memory(rewind->state);
+    free_memory(rewind->compressed);
+    free_memory(rewind->ring);
+    rewind->snapshots = NULL;
+    rewind->keyframe = rewind->state = rewind->compressed = rewind->ring = NULL;
+    rewind->enabled = 0;
+}
+
+void
+gbc_rewind_reset(gbc_rewind_t *rewind)
+{
+    rewind->first = rewind->count = 0;
+    rewind->head = 0;
+    rewind->keyframe_valid = 0;
+    rewind->frames = rewind->deltas = 0;
+}
+
+int
+gbc_rewind_push(gbc_rewind_t *rewind)
+{
+    if (!rewind->enabled)
+        return 1;
+
+    size_t n = gbc_state_save(rewind->gbc, rewind->state, rewind->state_size);
+    if (!n)
+        return 1;
+
+    uint8_t keyframe = !rewind->keyframe_valid || rewind->deltas + 1 >= REWIND_KEYFRAME_INTERVAL;
+    size_t size, offset;
+
+    for (;;) {
+        size = gbc_compress(rewind->state, keyframe ? NULL : rewind->keyframe, n,
+            rewind->compressed, COMPRESS_BOUND(rewind->state_size));
+        if (!size)
+            return 1;
+
+        if (rewind->count == REWIND_MAX_SNAPSHOTS)
+            rewind_drop_oldest(rewind);
+        if (rewind_reserve(rewind, size, &offset))
+            return 1;
+
+        /* making room may have dropped the keyframe this delta is made against */
+        if (keyframe || rewind->keyframe_valid)
+            break;
+        keyframe = 1;
+    }
+
+    memcpy(rewind->ring + offset, rewind->compressed, size);
+    gbc_rewind_snapshot_t *snapshot = rewind_snapshot(rewind, rewind->count);
+    snapshot->offset = offset;
+    snapshot->size = size;
+    snapshot->serial = rewind->serial;
+    snapshot->keyframe = keyframe;
+    rewind->count++;
+    rewind->head = offset + size;
+
+    if (keyframe) {
+        memcpy(rewind->keyframe, rewind->state, n);
+        rewind->keyframe_serial = rewind->serial;
+        rewind->keyframe_valid = 1;
+        rewind->deltas = 0;
+    } else {
+        rewind->deltas++;
+    }
+    rewind->serial++;
+    return 0;
+}
+
+/* make sure the keyframe buffer holds the keyframe of the newest snapshot */
+static int
+rewind_decode_keyframe(gbc_rewind_t *rewind)
+{
+    if (rewind->keyframe_valid)
+        return 0;
+
+    for (uint32_t i = rewind->count; i-- > 0;) {
+        gbc_rewind_snapshot_t *snapshot = rewind_snapshot(rewind, i);
+        if (!snapshot->keyframe)
+            continue;
+        if (gbc_decompress(rewind->ring + snapshot->offset, snapshot->size, NULL, rewind->keyframe, rewind->state_size))
+            return 1;
+        rewind->keyframe_serial = snapshot->serial;
+        rewind->keyframe_valid = 1;
+        return 0;
+    }
+    return 1;
+}
+
+int
+gbc_rewind_pop(gbc_rewind_t *rewind)
+{
+    if (!rewind->enabled || !rewind->count)
+        return 1;
+
+    gbc_rewind_snapshot_t *snapshot = rewind_snapshot(rewind, rewind->count - 1);
+    if (rewind_decode_keyframe(rewind)) {
+        LOG_ERROR("[REWIND] Lost the keyframe\n");
+        gbc_rewind_reset(rewind);
+        return 1;
+    }
+
+    if (gbc_decompress(rewind->ring + snapshot->offset, snapshot->size,
+            snapshot->keyframe ? NULL : rewind->keyframe, rewind->state, rewind->state_size) ||
+        gbc_state_load(rewind->gbc, rewind->state, rewind->state_size)) {
+        LOG_ERROR("[REWIND] Corrupted snapshot\n");
+        gbc_rewind_reset(rewind);
+        return 1;
+    }
+
+    /* the next push takes the place of this snapshot */
+    rewind->count--;
+    rewind->head = snapshot->offset;
+    rewind->serial = snapshot->serial;
+    if (snapshot->keyframe)
+        rewind->keyframe_valid = 0;
+    else
+        rewind->deltas = snapshot->serial - rewind->keyframe_serial - 1;
+    return 0;
+}
+
+void
+gbc_rewind_frame(gbc_rewind_t *rewind)
+{
+    if (!rewind->enabled || ++rewind->frames < rewind->interval)
+        return;
+
+    rewind->frames = 0;
+    gbc_rewind_push(rewind);
+}
+
+uint32_t
+gbc_rewind_count(gbc_rewind_t *rewind)
+{
+    return rewind->count;
+}
+
+size_t
+gbc_rewind_used(gbc_rewind_t *rewind)
+{
+    size_t used = 0;
+    for (uint32_t i = 0; i < rewind->count; i++)
+        used += rewind_snapshot(rewind, i)->size;
+    return used;
+}
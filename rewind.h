@@ -0,0 +1,81 @@
+#ifndef _REWIND_H
+#define _REWIND_H
+
+#include "common.h"
+
+/*
+Rewind.
+Every REWIND_DEFAULT_INTERVAL frames gbc_run() pushes a save state into a ring buffer, compressed
+with compress.h. One snapshot every REWIND_KEYFRAME_INTERVAL is a keyframe compressed on its own,
+the others are XOR deltas against the latest keyframe, so any snapshot decodes with at most two
+decompressions and most of them are a few hundred bytes.
+
+While rewinding, every frame pops the newest snapshot, loads it and runs one frame to show it,
+nothing is pushed until rewinding stops.
+
+The memory used is fixed at init and never grows: the index, the working buffers and the ring all
+come out of the budget. When the ring is full the oldest keyframe and its deltas are dropped.
+*/
+
+#define REWIND_DEFAULT_BUDGET (16 * 1024 * 1024)
+#define REWIND_DEFAULT_INTERVAL 1           /* frames between two snapshots */
+#define REWIND_KEYFRAME_INTERVAL 60         /* snapshots between two keyframes */
+#define REWIND_MAX_SNAPSHOTS 8192
+
+typedef struct gbc_rewind gbc_rewind_t;
+typedef struct gbc_rewind_snapshot gbc_rewind_snapshot_t;
+
+struct gbc_rewind_snapshot
+{
+    uint32_t offset;        /* in the ring */
+    uint32_t size;          /* compressed */
+    uint32_t serial;
+    uint8_t keyframe;
+};
+
+struct gbc_rewind
+{
+    struct gbc *gbc;
+
+    gbc_rewind_snapshot_t *snapshots;
+    uint32_t first;         /* the oldest snapshot in the index */
+    uint32_t count;
+    uint32_t serial;        /* of the next snapshot */
+
+    uint8_t *ring;
+    size_t ring_size;
+    size_t head;            /* where the next snapshot is written */
+
+    size_t state_size;
+    uint8_t *keyframe;      /* the decoded keyframe deltas are made against */
+    uint32_t keyframe_serial;
+    uint8_t keyframe_valid;
+    uint8_t *state;         /* scratch for one decoded state */
+    uint8_t *compressed;    /* scratch for one compressed state */
+
+    uint16_t interval;
+    uint16_t frames;        /* since the last snapshot */
+    uint16_t deltas;        /* since the last keyframe */
+
+    uint8_t enabled;
+    volatile uint8_t rewinding;
+};
+
+/* returns 0 on success, the cartridge must be loaded, the state size depends on it */
+int gbc_rewind_init(gbc_rewind_t *rewind, struct gbc *gbc, size_t budget, uint16_t interval);
+void gbc_rewind_destroy(gbc_rewind_t *rewind);
+/* drop every snapshot */
+void gbc_rewind_reset(gbc_rewind_t *rewind);
+
+/* called by gbc_run() after every frame, takes a snapshot every interval frames */
+void gbc_rewind_frame(gbc_rewind_t *rewind);
+/* take a snapshot now, returns 0 on success */
+int gbc_rewind_push(gbc_rewind_t *rewind);
+/* load the newest snapshot and drop it, returns 1 when there is nothing left */
+int gbc_rewind_pop(gbc_rewind_t *rewind);
+
+/* the number of snapshots and the bytes they use in the ring */
+uint32_t gbc_rewind_count(gbc_rewind_t *rewind);
+size_t gbc_rewind_used(gbc_rewind_t *rewind);
+
+#endif
@@ -0,0 +1,199 @@
+#include "scale.h"
+
+static void
+nearest_row(const gbc_scaler_t *scaler, const gbc_scale_pass_t *pass, const uint8_t *src, uint8_t *dst)
+{
+    uint8_t factor = pass->factor;
+
+    if (pass->bpp == 4) {
+        scaler->simd->row_scale((const uint32_t*)src, (uint32_t*)dst, pass->width, factor);
+    } else if (pass->bpp == 2) {
+        const uint16_t *from = (const uint16_t*)src;
+        uint16_t *to = (uint16_t*)dst;
+        for (int x = 0; x < pass->width; x++)
+            for (int i = 0; i < factor; i++)
+                *to++ = from[x];
+    } else {
+        for (int x = 0; x < pass->width; x++, dst += factor)
+            memset(dst, src[x], factor);
+    }
+}
+
+/* rows [from, to) of the source */
+static void
+scale_rows(const gbc_scaler_t *scaler, const gbc_scale_pass_t *pass, uint16_t from, uint16_t to)
+{
+    for (uint16_t y = from; y < to; y++) {
+        const uint8_t *src = pass->src + y * pass->src_stride;
+
+        if (pass->filter == SCALE_FILTER_SCALE2X) {
+            const uint8_t *above = y > 0 ? src - pass->src_stride : src;
+            const uint8_t *below = y < pass->height - 1 ? src + pass->src_stride : src;
+            uint8_t *dst = pass->dst + y * 2 * pass->dst_stride;
+            scaler->simd->row_scale2x((const uint32_t*)above, (const uint32_t*)src, (const uint32_t*)below,
+                (uint32_t*)dst, (uint32_t*)(dst + pass->dst_stride), pass->width);
+            continue;
+        }
+
+        /* the other rows of a pixel are copies of the first one */
+        uint8_t *dst = pass->dst + y * pass->factor * pass->dst_stride;
+        nearest_row(scaler, pass, src, dst);
+        for (int i = 1; i < pass->factor; i++)
+            memcpy(dst + i * pass->dst_stride, dst, pass->width * pass->factor * pass->bpp);
+    }
+}
+
+static inline void
+scale_band(const gbc_scaler_t *scaler, const gbc_scale_pass_t *pass, uint8_t index)
+{
+    scale_rows(scaler, pass, pass->height * index / scaler->threads, pass->height * (index + 1) / scaler->threads);
+}
+
+static void*
+scale_thread_main(void *udata)
+{
+    gbc_scale_thread_t *thread = (gbc_scale_thread_t*)udata;
+    gbc_scaler_t *scaler = thread->scaler;
+    uint32_t generation = 0;
+
+    pthread_mutex_lock(&scaler->lock);
+    for (;;) {
+        while (scaler->generation == generation && !scaler->stop)
+            pthread_cond_wait(&scaler->work, &scaler->lock);
+        if (scaler->stop)
+            break;
+
+        generation = scaler->generation;
+        gbc_scale_pass_t pass = scaler->pass;
+        pthread_mutex_unlock(&scaler->lock);
+        scale_band(scaler, &pass, thread->index);
+        pthread_mutex_lock(&scaler->lock);
+
+        if (--scaler->pending == 0)
+            pthread_cond_signal(&scaler->done);
+    }
+    pthread_mutex_unlock(&scaler->lock);
+    return NULL;
+}
+
+static void
+scale_run(gbc_scaler_t *scaler, const gbc_scale_pass_t *pass)
+{
+    if (scaler->threads <= 1) {
+        scale_band(scaler, pass, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&scaler->lock);
+    scaler->pass = *pass;
+    scaler->pending = scaler->threads - 1;
+    scaler->generation++;
+    pthread_cond_broadcast(&scaler->work);
+    pthread_mutex_unlock(&scaler->lock);
+
+    scale_band(scaler, pass, 0);
+
+    pthread_mutex_lock(&scaler->lock);
+    while (scaler->pending)
+        pthread_cond_wait(&scaler->done, &scaler->lock);
+    pthread_mutex_unlock(&scaler->lock);
+}
+
+int
+gbc_scaler_init(gbc_scaler_t *scaler, uint8_t threads)
+{
+    memset(scaler, 0, sizeof(gbc_scaler_t));
+    scaler->filter = SCALE_FILTER_NEAREST;
+    scaler->factor = 1;
+    scaler->simd = gbc_simd_select();
+
+    threads = threads < 1 ? 1 : threads > SCALE_MAX_THREADS ? SCALE_MAX_THREADS : threads;
+    pthread_mutex_init(&scaler->lock, NULL);
+    pthread_cond_init(&scaler->work, NULL);
+    pthread_cond_init(&scaler->done, NULL);
+
+    scaler->threads = 1;
+    for (uint8_t i = 1; i < threads; i++) {
+        gbc_scale_thread_t *thread = &scaler->thread[i];
+        thread->scaler = scaler;
+        thread->index = i;
+        if (pthread_create(&thread->thread, NULL, scale_thread_main, thread)) {
+            /* fewer threads is slower, not wrong */
+            LOG_ERROR("[SCALE] Failed to start thread %d, scaling with %d\n", i, scaler->threads);
+            break;
+        }
+        scaler->threads++;
+    }
+    return 0;
+}
+
+void
+gbc_scaler_destroy(gbc_scaler_t *scaler)
+{
+    pthread_mutex_lock(&scaler->lock);
+    scaler->stop = 1;
+    pthread_cond_broadcast(&scaler->work);
+    pthread_mutex_unlock(&scaler->lock);
+
+    for (uint8_t i = 1; i < scaler->threads; i++)
+        pthread_join(scaler->thread[i].thread, NULL);
+    pthread_mutex_destroy(&scaler->lock);
+    pthread_cond_destroy(&scaler->work);
+    pthread_cond_destroy(&scaler->done);
+}
+
+int
+gbc_scaler_set_filter(gbc_scaler_t *scaler, uint8_t filter, uint8_t factor)
+{
+    uint8_t valid = filter == SCALE_FILTER_NEAREST ? factor >= 1 && factor <= SCALE_MAX_FACTOR :
+        filter == SCALE_FILTER_SCALE2X ? factor == 2 || factor == 4 : 0;
+
+    if (!valid) {
+        LOG_ERROR("[SCALE] Invalid filter %d with factor %d\n", filter, factor);
+        return 1;
+    }
+    scaler->filter = filter;
+    scaler->factor = factor;
+    return 0;
+}
+
+int
+gbc_scale_frame(gbc_scaler_t *scaler, const void *src, uint32_t src_stride, uint8_t format,
+    void *dst, uint32_t dst_stride)
+{
+    if (format >= PIXEL_FORMATS) {
+        LOG_ERROR("[SCALE] Invalid pixel format %d\n", format);
+        return 1;
+    }
+
+    gbc_scale_pass_t pass = {
+        .src = (const uint8_t*)src,
+        .src_stride = src_stride,
+        .width = VISIBLE_HORIZONTAL_PIXELS,
+        .height = VISIBLE_VERTICAL_PIXELS,
+        .dst = (uint8_t*)dst,
+        .dst_stride = dst_stride,
+        .bpp = PIXEL_FORMAT_BYTES(format),
+        .filter = scaler->filter,
+        .factor = scaler->factor,
+    };
+
+    if (pass.filter == SCALE_FILTER_SCALE2X && pass.bpp != 4) {
+        LOG_ERROR("[SCALE] Scale2x needs 4 byte pixels\n");
+        return 1;
+    }
+
+    if (pass.filter == SCALE_FILTER_SCALE2X && pass.factor == 4) {
+        gbc_scale_pass_t first = pass;
+        first.dst = (uint8_t*)scaler->scale2x;
+        first.dst_stride = SCALE_WIDTH(2) * sizeof(uint32_t);
+        scale_run(scaler, &first);
+
+        pass.src = first.dst;
+        pass.src_stride = first.dst_stride;
+        pass.width = SCALE_WIDTH(2);
+        pass.height = SCALE_HEIGHT(2);
+    }
+    scale_run(scaler, &pass);
+    return 0;
+}
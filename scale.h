@@ -0,0 +1,81 @@
+#ifndef _SCALE_H
+#define _SCALE_H
+
+#include "common.h"
+#include "graphic.h"
+#include "simd.h"
+#include <pthread.h>
+
+/*
+Upscaling of finished frames on the CPU, for frontends that draw the pixels themselves or record
+videos. The frame is cut into bands of rows, one per thread, the calling thread does the first one.
+*/
+
+#define SCALE_FILTER_NEAREST 0    /* integer factors 1 to 8, every pixel format */
+#define SCALE_FILTER_SCALE2X 1    /* factors 2 and 4 (Scale2x twice), 4 byte pixel formats */
+#define SCALE_FILTERS        2
+
+#define SCALE_MAX_FACTOR  8
+#define SCALE_MAX_THREADS 8
+
+#define SCALE_WIDTH(factor) (VISIBLE_HORIZONTAL_PIXELS * (factor))
+#define SCALE_HEIGHT(factor) (VISIBLE_VERTICAL_PIXELS * (factor))
+
+typedef struct gbc_scaler gbc_scaler_t;
+typedef struct gbc_scale_pass gbc_scale_pass_t;
+typedef struct gbc_scale_thread gbc_scale_thread_t;
+
+/* one image to another, the rows are shared out between the threads */
+struct gbc_scale_pass
+{
+    const uint8_t *src;
+    uint32_t src_stride;
+    uint16_t width;
+    uint16_t height;
+    uint8_t *dst;
+    uint32_t dst_stride;
+    uint8_t bpp;
+    uint8_t filter;
+    uint8_t factor;
+};
+
+struct gbc_scale_thread
+{
+    gbc_scaler_t *scaler;
+    uint8_t index;
+    pthread_t thread;
+};
+
+struct gbc_scaler
+{
+    uint8_t filter;
+    uint8_t factor;
+    const gbc_simd_t *simd;
+
+    uint8_t threads;
+    uint8_t stop;
+    uint32_t generation;    /* bumped for every pass */
+    uint8_t pending;        /* threads still working on the pass */
+    gbc_scale_pass_t pass;
+    gbc_scale_thread_t thread[SCALE_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+
+    /* the first Scale2x of Scale4x */
+    uint32_t scale2x[SCALE_WIDTH(2) * SCALE_HEIGHT(2)];
+};
+
+/* threads is the number of threads that scale a frame, the calling one included */
+int gbc_scaler_init(gbc_scaler_t *scaler, uint8_t threads);
+void gbc_scaler_destroy(gbc_scaler_t *scaler);
+int gbc_scaler_set_filter(gbc_scaler_t *scaler, uint8_t filter, uint8_t factor);
+
+/*
+A frame from frame_ready to dst, SCALE_WIDTH(factor) by SCALE_HEIGHT(factor) pixels in the same format.
+Strides are in bytes.
+*/
+int gbc_scale_frame(gbc_scaler_t *scaler, const void *src, uint32_t src_stride, uint8_t format,
+    void *dst, uint32_t dst_stride);
+
+#endif
@@ -0,0 +1,552 @@
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+Every byte spread to 8 bytes, one bit per byte, leftmost pixel first.
+The color ids of a tile row are then spread[lo] | spread[hi] << 1, 8 pixels at once.
+*/
+static uint64_t tile_spread[2][256];   /* normal, x flipped */
+
+static void
+tile_spread_init()
+{
+    for (int b = 0; b < 256; b++) {
+        uint8_t normal[8], flipped[8];
+        for (int i = 0; i < 8; i++) {
+            normal[i] = (b >> (7 - i)) & 1;
+            flipped[i] = (b >> i) & 1;
+        }
+        memcpy(&tile_spread[0][b], normal, 8);
+        memcpy(&tile_spread[1][b], flipped, 8);
+    }
+}
+
+static void
+scalar_tile_decode(const uint8_t *data, uint8_t *pixels, uint8_t *pixels_xflip)
+{
+    for (int row = 0; row < 8; row++, data += 2) {
+        uint64_t ids = tile_spread[0][data[0]] | (tile_spread[0][data[1]] << 1);
+        uint64_t ids_xflip = tile_spread[1][data[0]] | (tile_spread[1][data[1]] << 1);
+        memcpy(pixels + row * 8, &ids, 8);
+        memcpy(pixels_xflip + row * 8, &ids_xflip, 8);
+    }
+}
+
+static void
+scalar_line_compose(const gbc_simd_line_t *line, uint8_t bg_enable, uint8_t *out)
+{
+    for (int i = 0; i < SIMD_LINE_PIXELS; i++) {
+        uint8_t show_obj = line->obj_color_id[i] &&
+            (!bg_enable || !line->bg_color_id[i] || !(line->bg_priority[i] | line->obj_priority[i]));
+        out[i] = show_obj ? line->obj_color[i] : line->bg_color[i];
+    }
+}
+
+static void
+scalar_palette_lookup(const uint32_t *palette, const uint8_t *colors, uint8_t *out, int count, int bytes)
+{
+    switch (bytes) {
+    case 4:
+        for (int i = 0; i < count; i++)
+            ((uint32_t*)out)[i] = palette[colors[i]];
+        break;
+    case 2:
+        for (int i = 0; i < count; i++)
+            ((uint16_t*)out)[i] = palette[colors[i]];
+        break;
+    default:
+        for (int i = 0; i < count; i++)
+            out[i] = palette[colors[i]];
+        break;
+    }
+}
+
+static void
+scalar_row_scale(const uint32_t *src, uint32_t *dst, int width, int factor)
+{
+    for (int x = 0; x < width; x++)
+        for (int i = 0; i < factor; i++)
+            *dst++ = src[x];
+}
+
+/* pixels [from, to) of a row, the SIMD versions use it for the edges */
+static inline void
+scale2x_pixels(const uint32_t *above, const uint32_t *row, const uint32_t *below,
+    uint32_t *dst0, uint32_t *dst1, int width, int from, int to)
+{
+    for (int x = from; x < to; x++) {
+        uint32_t b = above[x], h = below[x], e = row[x];
+        uint32_t d = row[x > 0 ? x - 1 : x], f = row[x < width - 1 ? x + 1 : x];
+
+        if (b != h && d != f) {
+            dst0[x * 2] = d == b ? d : e;
+            dst0[x * 2 + 1] = b == f ? f : e;
+            dst1[x * 2] = d == h ? d : e;
+            dst1[x * 2 + 1] = h == f ? f : e;
+        } else {
+            dst0[x * 2] = dst0[x * 2 + 1] = dst1[x * 2] = dst1[x * 2 + 1] = e;
+        }
+    }
+}
+
+static void
+scalar_row_scale2x(const uint32_t *above, const uint32_t *row, const uint32_t *below,
+    uint32_t *dst0, uint32_t *dst1, int width)
+{
+    scale2x_pixels(above, row, below, dst0, dst1, width, 0, width);
+}
+
+static void
+scalar_frame_blend(const uint8_t *prev, uint8_t *cur, int size, uint8_t weight)
+{
+    for (int i = 0; i < size; i++)
+        cur[i] = (cur[i] * (256 - weight) + prev[i] * weight + 128) >> 8;
+}
+
+static void
+scalar_row_diff(const uint8_t *a, const uint8_t *b, int size, int *first, int *last)
+{
+    int i = 0, j = size - 1;
+
+    while (i < size && a[i] == b[i])
+        i++;
+    if (i == size) {
+        *first = size;
+        *last = -1;
+        return;
+    }
+    while (a[j] == b[j])
+        j--;
+    *first = i;
+    *last = j;
+}
+
+static const gbc_simd_t simd_scalar = {
+    "scalar", scalar_tile_decode, scalar_line_compose, scalar_palette_lookup, scalar_row_scale, scalar_row_scale2x, scalar_frame_blend,
+    scalar_row_diff
+};
+
+#ifdef SIMD_X86
+
+__attribute__((target("sse2")))
+static void
+sse2_line_compose(const gbc_simd_line_t *line, uint8_t bg_enable, uint8_t *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bg_off = bg_enable ? zero : _mm_set1_epi8(-1);
+
+    for (int i = 0; i < SIMD_LINE_PIXELS; i += 16) {
+        __m128i obj_id = _mm_loadu_si128((const __m128i*)(line->obj_color_id + i));
+        __m128i bg_id = _mm_loadu_si128((const __m128i*)(line->bg_color_id + i));
+        __m128i priority = _mm_or_si128(
+            _mm_loadu_si128((const __m128i*)(line->bg_priority + i)),
+            _mm_loadu_si128((const __m128i*)(line->obj_priority + i)));
+
+        __m128i cond = _mm_or_si128(bg_off, _mm_or_si128(_mm_cmpeq_epi8(bg_id, zero), _mm_cmpeq_epi8(priority, zero)));
+        __m128i show_obj = _mm_andnot_si128(_mm_cmpeq_epi8(obj_id, zero), cond);
+
+        __m128i bg = _mm_loadu_si128((const __m128i*)(line->bg_color + i));
+        __m128i obj = _mm_loadu_si128((const __m128i*)(line->obj_color + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(_mm_and_si128(show_obj, obj), _mm_andnot_si128(show_obj, bg)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+avx2_line_compose(const gbc_simd_line_t *line, uint8_t bg_enable, uint8_t *out)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bg_off = bg_enable ? zero : _mm256_set1_epi8(-1);
+
+    for (int i = 0; i < SIMD_LINE_PIXELS; i += 32) {
+        __m256i obj_id = _mm256_loadu_si256((const __m256i*)(line->obj_color_id + i));
+        __m256i bg_id = _mm256_loadu_si256((const __m256i*)(line->bg_color_id + i));
+        __m256i priority = _mm256_or_si256(
+            _mm256_loadu_si256((const __m256i*)(line->bg_priority + i)),
+            _mm256_loadu_si256((const __m256i*)(line->obj_priority + i)));
+
+        __m256i cond = _mm256_or_si256(bg_off,
+            _mm256_or_si256(_mm256_cmpeq_epi8(bg_id, zero), _mm256_cmpeq_epi8(priority, zero)));
+        __m256i show_obj = _mm256_andnot_si256(_mm256_cmpeq_epi8(obj_id, zero), cond);
+
+        __m256i bg = _mm256_loadu_si256((const __m256i*)(line->bg_color + i));
+        __m256i obj = _mm256_loadu_si256((const __m256i*)(line->obj_color + i));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_blendv_epi8(bg, obj, show_obj));
+    }
+}
+
+/* 8 pixels per gather, the narrower pixels are packed down, they fit so nothing saturates */
+__attribute__((target("avx2")))
+static void
+avx2_palette_lookup(const uint32_t *palette, const uint8_t *colors, uint8_t *out, int count, int bytes)
+{
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(colors + i)));
+        __m256i pixels = _mm256_i32gather_epi32((const int*)palette, idx, 4);
+        if (bytes == 4) {
+            _mm256_storeu_si256((__m256i*)(out + i * 4), pixels);
+            continue;
+        }
+        /* the packs saturate, the pixels are masked to keep the low bytes */
+        pixels = _mm256_and_si256(pixels, _mm256_set1_epi32(bytes == 2 ? 0xffff : 0xff));
+        __m128i pixels16 = _mm_packus_epi32(_mm256_castsi256_si128(pixels), _mm256_extracti128_si256(pixels, 1));
+        if (bytes == 2)
+            _mm_storeu_si128((__m128i*)(out + i * 2), pixels16);
+        else
+            _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(pixels16, pixels16));
+    }
+    scalar_palette_lookup(palette, colors + i, out + i * bytes, count - i, bytes);
+}
+
+__attribute__((target("sse2")))
+static void
+sse2_row_scale(const uint32_t *src, uint32_t *dst, int width, int factor)
+{
+    int x = 0;
+
+    if (factor == 2) {
+        for (; x + 4 <= width; x += 4, dst += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+            _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi32(v, v));
+        }
+    } else if (factor == 4) {
+        for (; x + 4 <= width; x += 4, dst += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+            _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi32(v, 0x00));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_shuffle_epi32(v, 0x55));
+            _mm_storeu_si128((__m128i*)(dst + 8), _mm_shuffle_epi32(v, 0xaa));
+            _mm_storeu_si128((__m128i*)(dst + 12), _mm_shuffle_epi32(v, 0xff));
+        }
+    } else if (factor >= 3) {
+        /* whole vectors, the few pixels past a run are overwritten by the next one */
+        for (; x < width - 1; x++, dst += factor) {
+            __m128i v = _mm_set1_epi32(src[x]);
+            for (int i = 0; i < factor; i += 4)
+                _mm_storeu_si128((__m128i*)(dst + i), v);
+        }
+    }
+    scalar_row_scale(src + x, dst, width - x, factor);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+sse2_select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__attribute__((target("sse2")))
+static void
+sse2_row_scale2x(const uint32_t *above, const uint32_t *row, const uint32_t *below,
+    uint32_t *dst0, uint32_t *dst1, int width)
+{
+    const __m128i ones = _mm_set1_epi32(-1);
+    int x = 1;
+
+    scale2x_pixels(above, row, below, dst0, dst1, width, 0, 1);
+    for (; x + 5 <= width; x += 4) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(above + x));
+        __m128i h = _mm_loadu_si128((const __m128i*)(below + x));
+        __m128i e = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i d = _mm_loadu_si128((const __m128i*)(row + x - 1));
+        __m128i f = _mm_loadu_si128((const __m128i*)(row + x + 1));
+
+        __m128i edge = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)), ones);
+        __m128i e0 = sse2_select(_mm_and_si128(edge, _mm_cmpeq_epi32(d, b)), d, e);
+        __m128i e1 = sse2_select(_mm_and_si128(edge, _mm_cmpeq_epi32(b, f)), f, e);
+        __m128i e2 = sse2_select(_mm_and_si128(edge, _mm_cmpeq_epi32(d, h)), d, e);
+        __m128i e3 = sse2_select(_mm_and_si128(edge, _mm_cmpeq_epi32(h, f)), f, e);
+
+        _mm_storeu_si128((__m128i*)(dst0 + x * 2), _mm_unpacklo_epi32(e0, e1));
+        _mm_storeu_si128((__m128i*)(dst0 + x * 2 + 4), _mm_unpackhi_epi32(e0, e1));
+        _mm_storeu_si128((__m128i*)(dst1 + x * 2), _mm_unpacklo_epi32(e2, e3));
+        _mm_storeu_si128((__m128i*)(dst1 + x * 2 + 4), _mm_unpackhi_epi32(e2, e3));
+    }
+    scale2x_pixels(above, row, below, dst0, dst1, width, x, width);
+}
+
+/* 16 bit lanes, 255 * 256 + 128 still fits */
+__attribute__((target("sse2")))
+static void
+sse2_frame_blend(const uint8_t *prev, uint8_t *cur, int size, uint8_t weight)
+{
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(128);
+    const __m128i w = _mm_set1_epi16(weight), inv = _mm_set1_epi16(256 - weight);
+    int i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(cur + i));
+        __m128i p = _mm_loadu_si128((const __m128i*)(prev + i));
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), inv), _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), w)), round);
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), inv), _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), w)), round);
+        _mm_storeu_si128((__m128i*)(cur + i), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+    scalar_frame_blend(prev + i, cur + i, size - i, weight);
+}
+
+__attribute__((target("avx2")))
+static void
+avx2_frame_blend(const uint8_t *prev, uint8_t *cur, int size, uint8_t weight)
+{
+    const __m256i zero = _mm256_setzero_si256(), round = _mm256_set1_epi16(128);
+    const __m256i w = _mm256_set1_epi16(weight), inv = _mm256_set1_epi16(256 - weight);
+    int i = 0;
+
+    /* unpack and pack work within 128 bit lanes, the bytes come back in order */
+    for (; i + 32 <= size; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(cur + i));
+        __m256i p = _mm256_loadu_si256((const __m256i*)(prev + i));
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(c, zero), inv), _mm256_mullo_epi16(_mm256_unpacklo_epi8(p, zero), w)), round);
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(c, zero), inv), _mm256_mullo_epi16(_mm256_unpackhi_epi8(p, zero), w)), round);
+        _mm256_storeu_si256((__m256i*)(cur + i), _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+    }
+    scalar_frame_blend(prev + i, cur + i, size - i, weight);
+}
+
+/* one bit per byte that differs */
+__attribute__((target("sse2")))
+static inline uint32_t
+sse2_diff_mask(const uint8_t *a, const uint8_t *b)
+{
+    __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)a), _mm_loadu_si128((const __m128i*)b));
+    return ~_mm_movemask_epi8(eq) & 0xffff;
+}
+
+__attribute__((target("sse2")))
+static void
+sse2_row_diff(const uint8_t *a, const uint8_t *b, int size, int *first, int *last)
+{
+    int vectors = size & ~15, i, tail_first, tail_last;
+    uint32_t mask = 0;
+
+    /* the few bytes past the last vector */
+    scalar_row_diff(a + vectors, b + vectors, size - vectors, &tail_first, &tail_last);
+
+    for (i = 0; i < vectors; i += 16)
+        if ((mask = sse2_diff_mask(a + i, b + i)))
+            break;
+    if (i == vectors) {
+        *first = tail_last < 0 ? size : vectors + tail_first;
+        *last = tail_last < 0 ? -1 : vectors + tail_last;
+        return;
+    }
+    *first = i + __builtin_ctz(mask);
+
+    if (tail_last >= 0) {
+        *last = vectors + tail_last;
+        return;
+    }
+    /* stops at the vector of the first difference at the latest */
+    for (i = vectors - 16; !(mask = sse2_diff_mask(a + i, b + i)); i -= 16)
+        ;
+    *last = i + 31 - __builtin_clz(mask);
+}
+
+/*
+SSE2 has no gather, 4 loads and a shuffle are no faster than the scalar lookup.
+A tile decodes faster from the spread table, 16 bytes in are too few to pay for the shuffles.
+*/
+static const gbc_simd_t simd_sse2 = {
+    "sse2", scalar_tile_decode, sse2_line_compose, scalar_palette_lookup, sse2_row_scale, sse2_row_scale2x, sse2_frame_blend,
+    sse2_row_diff
+};
+/* the scalers are bound by stores, SSE2 is as good as it gets */
+static const gbc_simd_t simd_avx2 = {
+    "avx2", scalar_tile_decode, avx2_line_compose, avx2_palette_lookup, sse2_row_scale, sse2_row_scale2x, avx2_frame_blend,
+    sse2_row_diff
+};
+
+#endif
+
+#ifdef SIMD_NEON
+
+static void
+neon_tile_decode(const uint8_t *data, uint8_t *pixels, uint8_t *pixels_xflip)
+{
+    static const uint8_t bit_order[8] = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+    static const uint8_t bit_order_xflip[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+    const uint8x8_t bits = vld1_u8(bit_order), bits_xflip = vld1_u8(bit_order_xflip);
+    const uint8x8_t one = vdup_n_u8(1), two = vdup_n_u8(2);
+
+    for (int row = 0; row < 8; row++, data += 2) {
+        uint8x8_t lo = vdup_n_u8(data[0]), hi = vdup_n_u8(data[1]);
+        vst1_u8(pixels + row * 8, vorr_u8(vand_u8(vtst_u8(lo, bits), one), vand_u8(vtst_u8(hi, bits), two)));
+        vst1_u8(pixels_xflip + row * 8,
+            vorr_u8(vand_u8(vtst_u8(lo, bits_xflip), one), vand_u8(vtst_u8(hi, bits_xflip), two)));
+    }
+}
+
+static void
+neon_line_compose(const gbc_simd_line_t *line, uint8_t bg_enable, uint8_t *out)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t bg_off = vdupq_n_u8(bg_enable ? 0 : 0xff);
+
+    for (int i = 0; i < SIMD_LINE_PIXELS; i += 16) {
+        uint8x16_t obj_id = vld1q_u8(line->obj_color_id + i);
+        uint8x16_t bg_id = vld1q_u8(line->bg_color_id + i);
+        uint8x16_t priority = vorrq_u8(vld1q_u8(line->bg_priority + i), vld1q_u8(line->obj_priority + i));
+
+        uint8x16_t cond = vorrq_u8(bg_off, vorrq_u8(vceqq_u8(bg_id, zero), vceqq_u8(priority, zero)));
+        uint8x16_t show_obj = vbicq_u8(cond, vceqq_u8(obj_id, zero));
+
+        vst1q_u8(out + i, vbslq_u8(show_obj, vld1q_u8(line->obj_color + i), vld1q_u8(line->bg_color + i)));
+    }
+}
+
+static void
+neon_row_scale(const uint32_t *src, uint32_t *dst, int width, int factor)
+{
+    int x = 0;
+
+    if (factor == 2) {
+        for (; x + 4 <= width; x += 4, dst += 8) {
+            uint32x4_t v = vld1q_u32(src + x);
+            uint32x4x2_t twice = {{v, v}};
+            vst2q_u32(dst, twice);
+        }
+    } else if (factor >= 3) {
+        for (; x < width - 1; x++, dst += factor) {
+            uint32x4_t v = vdupq_n_u32(src[x]);
+            for (int i = 0; i < factor; i += 4)
+                vst1q_u32(dst + i, v);
+        }
+    }
+    scalar_row_scale(src + x, dst, width - x, factor);
+}
+
+static void
+neon_row_scale2x(const uint32_t *above, const uint32_t *row, const uint32_t *below,
+    uint32_t *dst0, uint32_t *dst1, int width)
+{
+    int x = 1;
+
+    scale2x_pixels(above, row, below, dst0, dst1, width, 0, 1);
+    for (; x + 5 <= width; x += 4) {
+        uint32x4_t b = vld1q_u32(above + x), h = vld1q_u32(below + x), e = vld1q_u32(row + x);
+        uint32x4_t d = vld1q_u32(row + x - 1), f = vld1q_u32(row + x + 1);
+
+        uint32x4_t edge = vmvnq_u32(vorrq_u32(vceqq_u32(b, h), vceqq_u32(d, f)));
+        uint32x4x2_t top = {{
+            vbslq_u32(vandq_u32(edge, vceqq_u32(d, b)), d, e),
+            vbslq_u32(vandq_u32(edge, vceqq_u32(b, f)), f, e)
+        }};
+        uint32x4x2_t bottom = {{
+            vbslq_u32(vandq_u32(edge, vceqq_u32(d, h)), d, e),
+            vbslq_u32(vandq_u32(edge, vceqq_u32(h, f)), f, e)
+        }};
+        vst2q_u32(dst0 + x * 2, top);
+        vst2q_u32(dst1 + x * 2, bottom);
+    }
+    scale2x_pixels(above, row, below, dst0, dst1, width, x, width);
+}
+
+static void
+neon_frame_blend(const uint8_t *prev, uint8_t *cur, int size, uint8_t weight)
+{
+    const uint16x8_t w = vdupq_n_u16(weight), inv = vdupq_n_u16(256 - weight);
+    int i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t c = vld1q_u8(cur + i), p = vld1q_u8(prev + i);
+        uint16x8_t lo = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(c)), inv), vmovl_u8(vget_low_u8(p)), w);
+        uint16x8_t hi = vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(c)), inv), vmovl_u8(vget_high_u8(p)), w);
+        vst1q_u8(cur + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    scalar_frame_blend(prev + i, cur + i, size - i, weight);
+}
+
+/* NEON has no movemask, the vectors only find the first and the last 16 bytes that differ */
+static void
+neon_row_diff(const uint8_t *a, const uint8_t *b, int size, int *first, int *last)
+{
+    int vectors = size & ~15, i, j, tail_first, tail_last;
+
+    scalar_row_diff(a + vectors, b + vectors, size - vectors, &tail_first, &tail_last);
+
+    for (i = 0; i < vectors; i += 16)
+        if (vminvq_u8(vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i))) == 0)
+            break;
+    if (i == vectors) {
+        *first = tail_last < 0 ? size : vectors + tail_first;
+        *last = tail_last < 0 ? -1 : vectors + tail_last;
+        return;
+    }
+
+    if (tail_last >= 0) {
+        scalar_row_diff(a + i, b + i, 16, first, &j);
+        *first += i;
+        *last = vectors + tail_last;
+        return;
+    }
+    for (j = vectors - 16; vminvq_u8(vceqq_u8(vld1q_u8(a + j), vld1q_u8(b + j))) != 0; j -= 16)
+        ;
+    scalar_row_diff(a + i, b + i, j + 16 - i, first, last);
+    *first += i;
+    *last += i;
+}
+
+/* NEON has no gather either, a table lookup only reaches 64 bytes, a quarter of the palette */
+static const gbc_simd_t simd_neon = {
+    "neon", neon_tile_decode, neon_line_compose, scalar_palette_lookup, neon_row_scale, neon_row_scale2x, neon_frame_blend,
+    neon_row_diff
+};
+
+#endif
+
+int
+gbc_simd_available(const gbc_simd_t **list, int size)
+{
+    int n = 0;
+    static uint8_t spread_ready = 0;
+
+    if (!spread_ready) {
+        tile_spread_init();
+        spread_ready = 1;
+    }
+
+    if (n < size)
+        list[n++] = &simd_scalar;
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (n < size && __builtin_cpu_supports("sse2"))
+        list[n++] = &simd_sse2;
+    if (n < size && __builtin_cpu_supports("avx2"))
+        list[n++] = &simd_avx2;
+#endif
+
+#ifdef SIMD_NEON
+    if (n < size)
+        list[n++] = &simd_neon;
+#endif
+
+    return n;
+}
+
+const gbc_simd_t*
+gbc_simd_select()
+{
+    const gbc_simd_t *list[4];
+    int n = gbc_simd_available(list, sizeof(list) / sizeof(list[0]));
+
+    /* the last one is the best */
+    LOG_DEBUG("[SIMD] Using %s\n", list[n - 1]->name);
+    return list[n - 1];
+}
@@ -0,0 +1,75 @@
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include "common.h"
+
+/*
+Data parallel kernels of the renderer, tile decoding, scanline composition and the palette lookup,
+and of the frame post-processing, upscaling in scale.c and frame blending.
+gbc_simd_select() picks the best implementation the CPU supports when the graphic module is
+initialized: AVX2 or SSE2 on x86, NEON on ARM64, plain C everywhere else.
+All the implementations give the same output, bit for bit.
+*/
+
+#define SIMD_LINE_PIXELS 160
+
+typedef struct gbc_simd gbc_simd_t;
+typedef struct gbc_simd_line gbc_simd_line_t;
+
+/*
+The layers of a scanline, see gbc_graphic_draw_line().
+Colors are indexes into the host palette, see HOST_PALETTE_BG() and HOST_PALETTE_OBJ().
+*/
+struct gbc_simd_line
+{
+    /* BG and window */
+    uint8_t bg_color_id[SIMD_LINE_PIXELS];
+    uint8_t bg_priority[SIMD_LINE_PIXELS];
+    uint8_t bg_color[SIMD_LINE_PIXELS];
+
+    /* objs, color id 0 means no obj */
+    uint8_t obj_color_id[SIMD_LINE_PIXELS];
+    uint8_t obj_priority[SIMD_LINE_PIXELS];
+    uint8_t obj_color[SIMD_LINE_PIXELS];
+};
+
+struct gbc_simd
+{
+    const char *name;
+
+    /* 16 bytes of 2bpp planar tile data to 64 color ids, as is and x flipped */
+    void (*tile_decode)(const uint8_t *data, uint8_t *pixels, uint8_t *pixels_xflip);
+
+    /*
+    https://gbdev.io/pandocs/Tile_Maps.html#bg-to-obj-priority-in-cgb-mode
+    An obj pixel is shown when it is not transparent and
+    LCDC.0 is clear, or the BG color id is 0, or neither the BG nor the obj has the priority bit.
+    */
+    void (*line_compose)(const gbc_simd_line_t *line, uint8_t bg_enable, uint8_t *out);
+
+    /* host palette indexes to pixels of 4, 2 or 1 bytes, the pixels are the low bytes of the palette entries */
+    void (*palette_lookup)(const uint32_t *palette, const uint8_t *colors, uint8_t *out, int count, int bytes);
+
+    /* every pixel of a row repeated factor times, 1 <= factor <= 8 */
+    void (*row_scale)(const uint32_t *src, uint32_t *dst, int width, int factor);
+
+    /*
+    https://www.scale2x.it/algorithm
+    A row to the two rows of Scale2x, above and below are the neighbour rows, the edges are repeated.
+    */
+    void (*row_scale2x)(const uint32_t *above, const uint32_t *row, const uint32_t *below,
+        uint32_t *dst0, uint32_t *dst1, int width);
+
+    /* every byte of cur mixed with prev, cur = (cur * (256 - weight) + prev * weight + 128) >> 8 */
+    void (*frame_blend)(const uint8_t *prev, uint8_t *cur, int size, uint8_t weight);
+
+    /* the first and the last byte that differ, size and -1 if the rows are the same */
+    void (*row_diff)(const uint8_t *a, const uint8_t *b, int size, int *first, int *last);
+};
+
+const gbc_simd_t* gbc_simd_select();
+
+/* every implementation this build and CPU can run, the scalar one first */
+int gbc_simd_available(const gbc_simd_t **list, int size);
+
+#endif
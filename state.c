@@ -0,0 +1,362 @@
+#include "state.h"
+#include "gbc.h"
+
+typedef struct state_io state_io_t;
+typedef void (*state_chunk_func)(state_io_t *io, gbc_t *gbc);
+
+/*
+The same function saves and loads a chunk, so the two directions can't get out of sync.
+With a NULL buffer it only counts the bytes.
+*/
+struct state_io
+{
+    uint8_t *buf;
+    size_t pos;
+    uint8_t saving;
+};
+
+static void
+state_field(state_io_t *io, void *p, size_t n)
+{
+    if (io->buf) {
+        if (io->saving)
+            memcpy(io->buf + io->pos, p, n);
+        else
+            memcpy(p, io->buf + io->pos, n);
+    }
+    io->pos += n;
+}
+
+#define STATE_FIELD(io, field) state_field((io), &(field), sizeof(field))
+/* bitfields don't have an address */
+#define STATE_BITFIELD(io, field) do {  \
+    uint8_t _v = (field);               \
+    state_field((io), &_v, 1);          \
+    (field) = _v;                       \
+} while (0)
+
+static void
+state_cpu(state_io_t *io, gbc_t *gbc)
+{
+    gbc_cpu_t *cpu = &gbc->cpu;
+    STATE_FIELD(io, cpu->regs);
+    STATE_FIELD(io, cpu->cycles);
+    STATE_FIELD(io, cpu->ins_cycles);
+    STATE_FIELD(io, cpu->ime);
+    STATE_FIELD(io, cpu->ier);
+    STATE_BITFIELD(io, cpu->ime_insts);
+    STATE_BITFIELD(io, cpu->halt);
+    STATE_BITFIELD(io, cpu->dspeed);
+}
+
+static void
+state_mem(state_io_t *io, gbc_t *gbc)
+{
+    gbc_memory_t *mem = &gbc->mem;
+    STATE_FIELD(io, mem->wram);
+    STATE_FIELD(io, mem->hraw);
+    STATE_FIELD(io, mem->io_ports);
+    STATE_FIELD(io, mem->oam);
+    STATE_FIELD(io, mem->bg_palette);
+    STATE_FIELD(io, mem->obj_palette);
+    STATE_FIELD(io, mem->boot_rom_enabled);
+    STATE_FIELD(io, mem->boot_rom);
+}
+
+static void
+state_mbc(state_io_t *io, gbc_t *gbc)
+{
+    gbc_mbc_t *mbc = &gbc->mbc;
+    STATE_FIELD(io, mbc->rom_bank);
+    STATE_FIELD(io, mbc->ram_bank);
+    STATE_FIELD(io, mbc->ram_enabled);
+    STATE_FIELD(io, mbc->mode);
+    /* only the banks the cartridge has */
+    state_field(io, mbc->ram_banks, mbc->ram_bank_size * RAM_BANK_SIZE);
+}
+
+static void
+state_ppu(state_io_t *io, gbc_t *gbc)
+{
+    gbc_graphic_t *graphic = &gbc->graphic;
+    STATE_FIELD(io, graphic->dots);
+    STATE_FIELD(io, graphic->scanline);
+    STATE_FIELD(io, graphic->mode);
+    STATE_FIELD(io, graphic->vram);
+    STATE_FIELD(io, graphic->lcd_warmup);
+
+    /* the accuracy is a setting of the host and isn't restored, the saved one tells the tier of the line fields */
+    uint8_t accuracy = graphic->accuracy;
+    STATE_FIELD(io, accuracy);
+    STATE_FIELD(io, graphic->mode3_dots);
+    STATE_FIELD(io, graphic->window_wy);
+    STATE_FIELD(io, graphic->window_line);
+    STATE_FIELD(io, graphic->window_shown);
+    STATE_FIELD(io, graphic->line_pending);
+    STATE_FIELD(io, graphic->line_stale);
+    STATE_FIELD(io, graphic->line_regs);
+    /* the other tier's line in progress is finished at once */
+    if (io->buf && !io->saving && accuracy != graphic->accuracy)
+        gbc_graphic_finish_line(graphic);
+}
+
+static void
+state_audio_channel(state_io_t *io, gbc_audio_channel_t *c)
+{
+    STATE_FIELD(io, c->NRx0);
+    STATE_FIELD(io, c->NRx1);
+    STATE_FIELD(io, c->NRx2);
+    STATE_FIELD(io, c->NRx3);
+    STATE_FIELD(io, c->NRx4);
+    STATE_FIELD(io, c->sample_cycles);
+    /* lfsr shares its storage with the sweep fields */
+    STATE_FIELD(io, c->lfsr);
+    STATE_FIELD(io, c->sweep_shadow_period);
+    STATE_FIELD(io, c->length_counter);
+    STATE_FIELD(io, c->waveform_idx);
+    STATE_FIELD(io, c->volume);
+    STATE_BITFIELD(io, c->volume_pace);
+    STATE_BITFIELD(io, c->volume_pace_counter);
+    STATE_BITFIELD(io, c->volume_dir);
+    STATE_BITFIELD(io, c->length_enabled);
+    STATE_BITFIELD(io, c->frame_sequencer_flag);
+    STATE_BITFIELD(io, c->on);
+}
+
+static void
+state_apu(state_io_t *io, gbc_t *gbc)
+{
+    gbc_audio_t *audio = &gbc->audio;
+    STATE_FIELD(io, audio->cycles);
+    state_audio_channel(io, &audio->c1);
+    state_audio_channel(io, &audio->c2);
+    state_audio_channel(io, &audio->c3);
+    state_audio_channel(io, &audio->c4);
+    STATE_FIELD(io, audio->NR52);
+    STATE_FIELD(io, audio->NR51);
+    STATE_FIELD(io, audio->NR50);
+    STATE_FIELD(io, audio->output_sample_cycles_remainder);
+    STATE_FIELD(io, audio->output_sample_cycles);
+    STATE_FIELD(io, audio->sample);
+    STATE_FIELD(io, audio->sample_divider);
+    STATE_FIELD(io, audio->m_cycles);
+    STATE_FIELD(io, audio->frame_sequencer);
+    STATE_BITFIELD(io, audio->frame_envelope_sweep);
+    STATE_BITFIELD(io, audio->frame_sound_length);
+    STATE_BITFIELD(io, audio->frame_freq_sweep);
+    STATE_FIELD(io, audio->div_apu);
+    STATE_FIELD(io, audio->waveforms);
+}
+
+static void
+state_timer(state_io_t *io, gbc_t *gbc)
+{
+    gbc_timer_t *timer = &gbc->timer;
+    STATE_FIELD(io, timer->div_cycles);
+    STATE_FIELD(io, timer->timer_cycles);
+}
+
+static struct {
+    const char *tag;
+    state_chunk_func func;
+} _chunks[] = {
+    {STATE_TAG_CPU, state_cpu},
+    {STATE_TAG_MEM, state_mem},
+    {STATE_TAG_MBC, state_mbc},
+    {STATE_TAG_PPU, state_ppu},
+    {STATE_TAG_APU, state_apu},
+    {STATE_TAG_TIMER, state_timer},
+};
+
+#define STATE_CHUNKS (sizeof(_chunks) / sizeof(_chunks[0]))
+
+static uint32_t
+state_chunk_size(gbc_t *gbc, int idx)
+{
+    state_io_t io = {NULL, 0, 1};
+    _chunks[idx].func(&io, gbc);
+    return io.pos;
+}
+
+static void
+state_put_u32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint32_t
+state_get_u32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+size_t
+gbc_state_size(gbc_t *gbc)
+{
+    size_t size = STATE_HEADER_SIZE + STATE_CHUNK_HEADER_SIZE;
+    for (int i = 0; i < STATE_CHUNKS; i++)
+        size += STATE_CHUNK_HEADER_SIZE + state_chunk_size(gbc, i);
+    return size;
+}
+
+size_t
+gbc_state_save(gbc_t *gbc, uint8_t *buf, size_t size)
+{
+    cartridge_t *cart = gbc->mbc.cart;
+    size_t total = gbc_state_size(gbc);
+    uint16_t version = STATE_VERSION;
+
+    if (size < total) {
+        LOG_ERROR("[STATE] Buffer too small: %zu < %zu\n", size, total);
+        return 0;
+    }
+
+    memset(buf, 0, STATE_HEADER_SIZE);
+    memcpy(buf, STATE_MAGIC, STATE_TAG_SIZE);
+    memcpy(buf + 4, &version, sizeof(version));
+    state_put_u32(buf + 8, total);
+    buf[12] = cart->header_checksum;
+    memcpy(buf + 13, &cart->global_checksum, sizeof(cart->global_checksum));
+
+    state_io_t io = {buf, STATE_HEADER_SIZE, 1};
+    for (int i = 0; i < STATE_CHUNKS; i++) {
+        uint32_t chunk_size = state_chunk_size(gbc, i);
+        memcpy(buf + io.pos, _chunks[i].tag, STATE_TAG_SIZE);
+        state_put_u32(buf + io.pos + STATE_TAG_SIZE, chunk_size);
+        io.pos += STATE_CHUNK_HEADER_SIZE;
+        _chunks[i].func(&io, gbc);
+    }
+
+    memcpy(buf + io.pos, STATE_TAG_END, STATE_TAG_SIZE);
+    state_put_u32(buf + io.pos + STATE_TAG_SIZE, 0);
+    io.pos += STATE_CHUNK_HEADER_SIZE;
+
+    assert(io.pos == total);
+    return io.pos;
+}
+
+static int
+state_find_chunk(const uint8_t *tag)
+{
+    for (int i = 0; i < STATE_CHUNKS; i++) {
+        if (memcmp(tag, _chunks[i].tag, STATE_TAG_SIZE) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* first pass, check everything before touching the machine */
+static int
+state_validate(gbc_t *gbc, const uint8_t *buf, size_t size)
+{
+    cartridge_t *cart = gbc->mbc.cart;
+    uint16_t version;
+    uint16_t global_checksum;
+    uint8_t found[STATE_CHUNKS];
+
+    if (size < STATE_HEADER_SIZE || memcmp(buf, STATE_MAGIC, STATE_TAG_SIZE) != 0) {
+        LOG_ERROR("[STATE] Not a save state\n");
+        return 1;
+    }
+
+    memcpy(&version, buf + 4, sizeof(version));
+    if (version != STATE_VERSION) {
+        LOG_ERROR("[STATE] Unsupported version %d\n", version);
+        return 1;
+    }
+
+    if (state_get_u32(buf + 8) > size) {
+        LOG_ERROR("[STATE] Truncated state\n");
+        return 1;
+    }
+    size = state_get_u32(buf + 8);
+
+    memcpy(&global_checksum, buf + 13, sizeof(global_checksum));
+    if (buf[12] != cart->header_checksum || global_checksum != cart->global_checksum) {
+        LOG_ERROR("[STATE] The state belongs to another cartridge\n");
+        return 1;
+    }
+
+    memset(found, 0, sizeof(found));
+    size_t pos = STATE_HEADER_SIZE;
+    for (;;) {
+        if (pos + STATE_CHUNK_HEADER_SIZE > size) {
+            LOG_ERROR("[STATE] Missing END chunk\n");
+            return 1;
+        }
+
+        const uint8_t *tag = buf + pos;
+        uint32_t chunk_size = state_get_u32(buf + pos + STATE_TAG_SIZE);
+        pos += STATE_CHUNK_HEADER_SIZE;
+
+        if (memcmp(tag, STATE_TAG_END, STATE_TAG_SIZE) == 0)
+            break;
+
+        if (chunk_size > size - pos) {
+            LOG_ERROR("[STATE] Chunk %.4s is truncated\n", tag);
+            return 1;
+        }
+
+        int idx = state_find_chunk(tag);
+        if (idx >= 0) {
+            if (chunk_size < state_chunk_size(gbc, idx)) {
+                LOG_ERROR("[STATE] Chunk %.4s is too short: %u\n", tag, chunk_size);
+                return 1;
+            }
+            found[idx] = 1;
+        } else {
+            LOG_INFO("[STATE] Skipping unknown chunk %.4s\n", tag);
+        }
+        pos += chunk_size;
+    }
+
+    for (int i = 0; i < STATE_CHUNKS; i++) {
+        if (!found[i]) {
+            LOG_ERROR("[STATE] Missing chunk %s\n", _chunks[i].tag);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* what is derived from the saved state is rebuilt instead of saved */
+static void
+state_refresh(gbc_t *gbc)
+{
+    gbc_graphic_invalidate_tiles(&gbc->graphic);
+    gbc_mem_palette_refresh(&gbc->mem);
+    gbc->mem.oam_dirty = 1;
+}
+
+int
+gbc_state_load(gbc_t *gbc, const uint8_t *buf, size_t size)
+{
+    if (state_validate(gbc, buf, size))
+        return 1;
+
+    /* the render thread may still be drawing from VRAM */
+    gbc_graphic_sync(&gbc->graphic);
+
+    size_t pos = STATE_HEADER_SIZE;
+    for (;;) {
+        const uint8_t *tag = buf + pos;
+        uint32_t chunk_size = state_get_u32(buf + pos + STATE_TAG_SIZE);
+        pos += STATE_CHUNK_HEADER_SIZE;
+
+        if (memcmp(tag, STATE_TAG_END, STATE_TAG_SIZE) == 0)
+            break;
+
+        int idx = state_find_chunk(tag);
+        if (idx >= 0) {
+            state_io_t io = {(uint8_t*)buf + pos, 0, 0};
+            _chunks[idx].func(&io, gbc);
+        }
+        pos += chunk_size;
+    }
+
+    state_refresh(gbc);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef _STATE_H
+#define _STATE_H
+
+#include "gbc.h"
+
+/*
+Save states.
+A state is a header followed by chunks, every chunk is a 4 bytes tag, a 4 bytes size and the payload:
+
+    "GBCS" version(2) reserved(2) size(4) header_checksum(1) global_checksum(2) reserved(1)
+    "CPU " size payload
+    "MEM " size payload
+    ...
+    "END " 0
+
+Only the machine state is saved, field by field, host pointers(memory map, io port pointers, callbacks)
+are never written, the ones in the running gbc_t are kept and the derived data is rebuilt after loading.
+Saving and loading work on caller-provided buffers and never allocate, use gbc_state_size() to
+size the buffer. Multi-byte values are stored in host byte order, like the rest of the emulator assumes.
+
+Chunks with unknown tags are skipped, a chunk shorter than what this version expects is an error.
+*/
+
+#define STATE_MAGIC "GBCS"
+#define STATE_VERSION 1
+#define STATE_TAG_SIZE 4
+#define STATE_HEADER_SIZE 16
+#define STATE_CHUNK_HEADER_SIZE 8
+
+#define STATE_TAG_CPU   "CPU "
+#define STATE_TAG_MEM   "MEM "
+#define STATE_TAG_MBC   "MBC "
+#define STATE_TAG_PPU   "PPU "
+#define STATE_TAG_APU   "APU "
+#define STATE_TAG_TIMER "TIMR"
+#define STATE_TAG_END   "END "
+
+/* the number of bytes gbc_state_save() needs at most */
+size_t gbc_state_size(gbc_t *gbc);
+
+/* returns the number of bytes written, 0 if the buffer is too small */
+size_t gbc_state_save(gbc_t *gbc, uint8_t *buf, size_t size);
+
+/* returns 0 on success, the machine is untouched if the state is rejected */
+int gbc_state_load(gbc_t *gbc, const uint8_t *buf, size_t size);
+
+#endif
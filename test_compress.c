@@ -0,0 +1,158 @@
+#include "compress.h"
+#include <assert.h>
+#include "test_util.h"
+
+/*
+Round trips of gbc_compress() and gbc_decompress() on random, zero filled and delta coded data,
+and the errors of both.
+
+Built with the GBC_BUILD_TESTS option of CMakeLists.txt.
+
+    ./test_compress
+*/
+
+#define TEST_ROUNDS 2000
+#define TEST_MAX_SIZE 4096
+#define TEST_BIG_SIZE (1 << 20)     /* lengths with a varint of 3 bytes */
+
+static uint8_t _src[TEST_BIG_SIZE];
+static uint8_t _ref[TEST_BIG_SIZE];
+static uint8_t _out[COMPRESS_BOUND(TEST_BIG_SIZE)];
+static uint8_t _dec[TEST_BIG_SIZE];
+
+/* random bytes, zero runs and byte runs of random lengths */
+static void
+test_fill_mixed(uint8_t *data, size_t size)
+{
+    size_t pos = 0;
+
+    while (pos < size) {
+        size_t n = test_rand() % 200 + 1;
+        uint8_t v = test_rand();
+        if (n > size - pos)
+            n = size - pos;
+        switch (test_rand() % 3) {
+        case 0:
+            for (size_t i = 0; i < n; i++)
+                data[pos + i] = test_rand();
+            break;
+        case 1:
+            memset(data + pos, 0, n);
+            break;
+        default:
+            memset(data + pos, v, n);
+            break;
+        }
+        pos += n;
+    }
+}
+
+/* compresses src against ref, checks the size against the bound and decompresses it back */
+static size_t
+test_round_trip(const uint8_t *src, const uint8_t *ref, size_t size)
+{
+    size_t n = gbc_compress(src, ref, size, _out, COMPRESS_BOUND(size));
+    assert(n > 0 && n <= COMPRESS_BOUND(size));
+
+    memset(_dec, 0xa5, size);
+    assert(gbc_decompress(_out, n, ref, _dec, size) == 0);
+    assert(memcmp(_dec, src, size) == 0);
+
+    /* one byte short of the compressed size is detected */
+    assert(gbc_compress(src, ref, size, _out, n - 1) == 0);
+    return n;
+}
+
+static void
+test_random()
+{
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        size_t size = test_rand() % TEST_MAX_SIZE + 1;
+        for (size_t i = 0; i < size; i++)
+            _src[i] = test_rand();
+        test_round_trip(_src, NULL, size);
+
+        test_fill_mixed(_src, size);
+        test_round_trip(_src, NULL, size);
+    }
+}
+
+static void
+test_zero()
+{
+    /* every size around the short length, the varint steps and the 8 bytes steps */
+    for (size_t size = 1; size < 300; size++) {
+        memset(_src, 0, size);
+        assert(test_round_trip(_src, NULL, size) == (size <= 63 ? 1 : size < 64 + 128 ? 2 : 3));
+    }
+
+    memset(_src, 0, TEST_BIG_SIZE);
+    assert(test_round_trip(_src, NULL, TEST_BIG_SIZE) <= 4);
+
+    memset(_src, 0x77, TEST_BIG_SIZE);
+    assert(test_round_trip(_src, NULL, TEST_BIG_SIZE) <= 5);
+}
+
+static void
+test_delta()
+{
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        size_t size = test_rand() % TEST_MAX_SIZE + 1;
+        int changes = test_rand() % 8;
+
+        test_fill_mixed(_ref, size);
+        memcpy(_src, _ref, size);
+        for (int i = 0; i < changes; i++)
+            _src[test_rand() % size] = test_rand();
+
+        size_t n = test_round_trip(_src, _ref, size);
+        if (!changes)
+            assert(n <= 3);
+
+        /* in place, the reference is overwritten with the data */
+        memcpy(_dec, _ref, size);
+        assert(gbc_decompress(_out, gbc_compress(_src, _ref, size, _out, sizeof(_out)), _dec, _dec, size) == 0);
+        assert(memcmp(_dec, _src, size) == 0);
+    }
+
+    /* a snapshot sized buffer with a few changed bytes */
+    test_fill_mixed(_ref, TEST_BIG_SIZE);
+    memcpy(_src, _ref, TEST_BIG_SIZE);
+    for (int i = 0; i < 16; i++)
+        _src[test_rand() % TEST_BIG_SIZE]++;
+    assert(test_round_trip(_src, _ref, TEST_BIG_SIZE) < 1024);
+}
+
+static void
+test_corrupted()
+{
+    size_t size = 1000;
+
+    test_fill_mixed(_src, size);
+    size_t n = gbc_compress(_src, NULL, size, _out, sizeof(_out));
+    assert(n > 0);
+
+    /* too short or too long for the size */
+    assert(gbc_decompress(_out, n, NULL, _dec, size - 1) == 1);
+    assert(gbc_decompress(_out, n, NULL, _dec, size + 1) == 1);
+    /* a literal cut short */
+    for (int i = 0; i < size; i++)
+        _src[i] = test_rand();
+    n = gbc_compress(_src, NULL, size, _out, sizeof(_out));
+    assert(gbc_decompress(_out, n - 1, NULL, _dec, size) == 1);
+    /* a varint that never ends */
+    memset(_out, 0xff, 16);
+    assert(gbc_decompress(_out, 16, NULL, _dec, size) == 1);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_random();
+    test_zero();
+    test_delta();
+    test_corrupted();
+
+    printf("ok\n");
+    return 0;
+}
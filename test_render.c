@@ -0,0 +1,361 @@
+#include "gbc.h"
+#include <assert.h>
+#include "test_util.h"
+
+/*
+The frames of a game are the same in every RENDER_MODE_*, with and without the layer cache, and
+whether the PPU is stepped a cycle at a time or by gbc_graphic_event() like gbc_run() does.
+Both PPU accuracy tiers are checked. The game runs with random VRAM, OAM, palette, SCX, DMA and HDMA
+writes between the cycles, so lines are drawn from data that keeps changing.
+Then the pixel format is changed in the middle of frames, every frame must be whole in one format
+and show what the RGBA frames show.
+The lines drawn by the scanline tier are also checked pixel by pixel against the per-pixel renderer
+the tile spans replaced, ported here as it was in a261d26. It knows nothing of DMG compatibility mode,
+so DMG games skip this check.
+
+Built with the GBC_BUILD_TESTS option of CMakeLists.txt.
+
+    ./test_render game.gbc
+*/
+
+#define TEST_FRAMES 120
+#define TEST_WRITE_CHANCE 40    /* a write every 40 cycles on average */
+
+#define TEST_STEP_CYCLE 0
+#define TEST_STEP_EVENT 1
+
+#define TEST_FORMAT_SWITCH 9973 /* cycles between two pixel format changes, a prime so they move in the frame */
+
+static uint32_t _frames_crc;
+static int _frames;
+
+/* the crcs of the RGBA frames converted to every format, INDEXED8 can't be converted */
+static uint32_t _format_crc[TEST_FRAMES][PIXEL_FORMATS];
+static uint8_t _format_record;
+static uint8_t _format_check;
+static uint8_t _reference;
+static int _reference_lines;
+
+static void
+test_audio_write(int8_t left, int8_t right)
+{
+}
+
+static void
+test_format_record(const uint32_t *pixels)
+{
+    static uint8_t converted[FRAMEBUFFER_PIXELS * 4];
+
+    for (uint8_t format = 0; format < PIXEL_FORMATS; format++) {
+        if (format == PIXEL_FORMAT_INDEXED8)
+            continue;
+        for (int i = 0; i < FRAMEBUFFER_PIXELS; i++) {
+            uint32_t r = pixels[i] & 0xff, g = (pixels[i] >> 8) & 0xff, b = (pixels[i] >> 16) & 0xff;
+            switch (format) {
+            case PIXEL_FORMAT_BGRA8888:
+                ((uint32_t*)converted)[i] = HOST_COLOR_BGRA(r, g, b);
+                break;
+            case PIXEL_FORMAT_RGB565:
+                ((uint16_t*)converted)[i] = HOST_COLOR_RGB565(r, g, b);
+                break;
+            case PIXEL_FORMAT_GRAY8:
+                converted[i] = HOST_COLOR_GRAY(r, g, b);
+                break;
+            default:
+                ((uint32_t*)converted)[i] = pixels[i];
+                break;
+            }
+        }
+        _format_crc[_frames][format] = checksum_crc32(converted, FRAMEBUFFER_STRIDE(format) * VISIBLE_VERTICAL_PIXELS);
+    }
+}
+
+static void
+test_frame_ready(void *udata, const void *buffer, uint16_t stride, uint8_t format)
+{
+    uint32_t crc = checksum_crc32((const uint8_t*)buffer, stride * VISIBLE_VERTICAL_PIXELS);
+
+    assert(_frames < TEST_FRAMES);
+    if (_format_record)
+        test_format_record((const uint32_t*)buffer);
+    if (_format_check) {
+        assert(stride == FRAMEBUFFER_STRIDE(format));
+        assert(format == PIXEL_FORMAT_INDEXED8 || crc == _format_crc[_frames][format]);
+    }
+    _frames_crc = _frames_crc * 31 + crc;
+    _frames++;
+}
+
+static void
+test_write(gbc_t *gbc, uint16_t addr, uint8_t data)
+{
+    gbc->cpu.mem_write(gbc->cpu.mem_data, addr, data);
+}
+
+static void
+test_random_write(gbc_t *gbc)
+{
+    switch (test_rand() % 10) {
+    case 0:
+    case 1:
+    case 2:
+        test_write(gbc, IO_PORT_BASE + IO_PORT_VBK, test_rand() & 1);
+        test_write(gbc, 0x8000 + test_rand() % 0x2000, test_rand());
+        break;
+    case 3:
+        test_write(gbc, 0xfe00 + test_rand() % 160, test_rand());
+        break;
+    case 4:
+        test_write(gbc, IO_PORT_BASE + IO_PORT_BCPS_BCPI, test_rand() & 0xbf);
+        test_write(gbc, IO_PORT_BASE + IO_PORT_BCPD_BGPD, test_rand());
+        break;
+    case 5:
+        test_write(gbc, IO_PORT_BASE + IO_PORT_OCPS_OCPI, test_rand() & 0xbf);
+        test_write(gbc, IO_PORT_BASE + IO_PORT_OCPD_OBPD, test_rand());
+        break;
+    case 6:
+        test_write(gbc, IO_PORT_BASE + IO_PORT_SCX, test_rand());
+        break;
+    case 7:
+        if (test_rand() % 500 == 0)
+            test_write(gbc, IO_PORT_BASE + IO_PORT_DMA, 0xc0 + test_rand() % 0x1f);
+        break;
+    case 8:
+        if (test_rand() % 500 == 0) {
+            test_write(gbc, IO_PORT_BASE + IO_PORT_HDMA1, 0xc0);
+            test_write(gbc, IO_PORT_BASE + IO_PORT_HDMA2, 0);
+            test_write(gbc, IO_PORT_BASE + IO_PORT_HDMA3, test_rand() & 0x1f);
+            test_write(gbc, IO_PORT_BASE + IO_PORT_HDMA4, 0);
+            test_write(gbc, IO_PORT_BASE + IO_PORT_HDMA5, test_rand() & 0x3f);
+        }
+        break;
+    default:
+        test_write(gbc, 0xc000 + test_rand() % 0x2000, test_rand());
+        break;
+    }
+}
+
+static const uint8_t*
+test_vram(gbc_t *gbc, uint16_t addr, uint8_t bank)
+{
+    return gbc->graphic.vram + bank * VRAM_BANK_SIZE + addr - VRAM_BEGIN;
+}
+
+static uint8_t
+test_tile_color_id(gbc_t *gbc, uint8_t obj, uint8_t idx, uint8_t bank, uint8_t x, uint8_t y)
+{
+    const uint8_t *tile = obj || (IO_PORT_READ(&gbc->mem, IO_PORT_LCDC) & LCDC_BG_WINDOW_TILE_DATA) ?
+        test_vram(gbc, 0x8000 + idx * 16, bank) : test_vram(gbc, 0x9000 + (int8_t)idx * 16, bank);
+    return ((tile[y * 2] >> (7 - x)) & 1) | (((tile[y * 2 + 1] >> (7 - x)) & 1) << 1);
+}
+
+/* a pixel of the tilemap at map, the BG attributes are in bank 1 */
+static uint8_t
+test_map_pixel(gbc_t *gbc, uint16_t map, uint16_t x, uint16_t y, uint8_t *color_id, uint8_t *priority)
+{
+    uint16_t offset = y / TILE_SIZE * 32 + x / TILE_SIZE;
+    uint8_t attr = test_vram(gbc, map, 1)[offset];
+    uint8_t tile_x = x % TILE_SIZE, tile_y = y % TILE_SIZE;
+
+    if (TILE_ATTR_XFLIP(attr))
+        tile_x = TILE_SIZE - tile_x - 1;
+    if (TILE_ATTR_YFLIP(attr))
+        tile_y = TILE_SIZE - tile_y - 1;
+    *color_id = test_tile_color_id(gbc, 0, test_vram(gbc, map, 0)[offset], TILE_ATTR_VRAM_BANK(attr) ? 1 : 0,
+        tile_x, tile_y);
+    if (TILE_ATTR_PRIORITY(attr))
+        *priority = 1;
+    return HOST_PALETTE_BG(TILE_ATTR_PALETTE(attr), *color_id);
+}
+
+/* gbc_graphic_render_pixel() of a261d26, it returns the host palette index instead of the color */
+static uint8_t
+test_reference_pixel(gbc_t *gbc, uint8_t scanline, uint8_t col, const uint8_t *objs_idx, uint8_t objs_count)
+{
+    uint8_t lcdc = IO_PORT_READ(&gbc->mem, IO_PORT_LCDC);
+    uint8_t lcdc_bit0 = lcdc & LCDC_BG_ENABLE;
+    uint8_t bg_color = HOST_PALETTE_BLANK, bg_color_id = 0, bgwin_priority = 0;
+
+    if (lcdc_bit0) {
+        uint8_t scroll_x = IO_PORT_READ(&gbc->mem, IO_PORT_SCX);
+        uint8_t scroll_y = IO_PORT_READ(&gbc->mem, IO_PORT_SCY);
+        bg_color = test_map_pixel(gbc, lcdc & LCDC_BG_TILE_MAP ? 0x9c00 : 0x9800,
+            (scroll_x + col) % TILE_MAP_SIZE, (scroll_y + scanline) % TILE_MAP_SIZE, &bg_color_id, &bgwin_priority);
+    }
+
+    if (lcdc & LCDC_WINDOW_ENABLE) {
+        uint8_t window_x = IO_PORT_READ(&gbc->mem, IO_PORT_WX) - 7;
+        uint8_t window_y = IO_PORT_READ(&gbc->mem, IO_PORT_WY);
+        if (scanline >= window_y && col >= window_x)
+            bg_color = test_map_pixel(gbc, lcdc & LCDC_WINDOW_TILE_MAP ? 0x9c00 : 0x9800,
+                col - window_x, scanline - window_y, &bg_color_id, &bgwin_priority);
+    }
+
+    if (lcdc_bit0 && bg_color_id && bgwin_priority)
+        return bg_color;
+
+    if (lcdc & LCDC_OBJ_ENABLE) {
+        for (int i = 0; i < objs_count; i++) {
+            gbc_obj_t *obj = (gbc_obj_t*)OAM_ADDR(&gbc->mem) + objs_idx[i];
+            uint8_t obj_y = OAM_Y_TO_SCREEN(obj->y);
+            uint8_t obj_x = OAM_X_TO_SCREEN(obj->x);
+
+            if (col < obj_x || col >= obj_x + OBJ_WIDTH)
+                continue;
+
+            uint8_t tile_idx = obj->tile;
+            uint8_t tile_x = col - obj_x;
+            uint8_t tile_y = scanline - obj_y;
+            if (lcdc & LCDC_OBJ_SIZE) {
+                if (scanline >= obj_y + OBJ_HEIGHT) {
+                    tile_y -= TILE_SIZE;
+                    tile_idx = OBJ_ATTR_YFLIP(obj->attr) ? tile_idx & 0xfe : tile_idx | 0x01;
+                } else {
+                    tile_idx = OBJ_ATTR_YFLIP(obj->attr) ? tile_idx | 0x01 : tile_idx & 0xfe;
+                }
+            }
+            if (OBJ_ATTR_XFLIP(obj->attr))
+                tile_x = TILE_SIZE - tile_x - 1;
+            if (OBJ_ATTR_YFLIP(obj->attr))
+                tile_y = TILE_SIZE - tile_y - 1;
+
+            uint8_t color_id = test_tile_color_id(gbc, 1, tile_idx, OBJ_ATTR_VRAM_BANK(obj->attr) ? 1 : 0,
+                tile_x, tile_y);
+            /* transparent */
+            if (!color_id)
+                continue;
+            if (OBJ_ATTR_BG_PRIORITY(obj->attr))
+                bgwin_priority = 1;
+            /* the first obj in OAM wins */
+            if (!bgwin_priority || !bg_color_id || !lcdc_bit0)
+                return HOST_PALETTE_OBJ(OBJ_ATTR_PALETTE(obj->attr), color_id);
+            break;
+        }
+    }
+    return bg_color;
+}
+
+/* mode 3 just started, the scanline tier drew the line from what the reference sees now */
+static void
+test_reference_line(gbc_t *gbc)
+{
+    gbc_graphic_t *graphic = &gbc->graphic;
+    uint8_t scanline = graphic->scanline;
+
+    if (graphic->skip_frame || graphic->lcd_warmup || gbc->mem.dmg_compat)
+        return;
+    assert(gbc->mem.pixel_format == PIXEL_FORMAT_RGBA8888);
+
+    uint8_t lcdc = IO_PORT_READ(&gbc->mem, IO_PORT_LCDC);
+    uint8_t obj_height = lcdc & LCDC_OBJ_SIZE ? OBJ_HEIGHT_2 : OBJ_HEIGHT;
+    gbc_obj_t *obj = (gbc_obj_t*)OAM_ADDR(&gbc->mem);
+    uint8_t objs_idx[MAX_OBJ_SCANLINE], objs = 0;
+    for (int i = 0; i < MAX_OBJS && objs < MAX_OBJ_SCANLINE; i++, obj++) {
+        uint8_t y = OAM_Y_TO_SCREEN(obj->y);
+        if (scanline >= y && scanline < y + obj_height)
+            objs_idx[objs++] = i;
+    }
+
+    const uint32_t *pixels = (const uint32_t*)graphic->framebuffer[graphic->front ^ 1] +
+        scanline * VISIBLE_HORIZONTAL_PIXELS;
+    for (int col = 0; col < VISIBLE_HORIZONTAL_PIXELS; col++)
+        assert(pixels[col] == gbc->mem.host_palette[test_reference_pixel(gbc, scanline, col, objs_idx, objs)]);
+    _reference_lines++;
+}
+
+/* the crc of the frames */
+static uint32_t
+test_run(gbc_t *gbc, const char *rom, uint8_t accuracy, uint8_t mode, uint8_t layer_cache, uint8_t step,
+    uint8_t format_switch)
+{
+    /* stops the render thread of the run before */
+    if (gbc->graphic.mem)
+        gbc_graphic_set_render_mode(&gbc->graphic, RENDER_MODE_LINE);
+
+    int ret = gbc_init(gbc, rom, NULL);
+    assert(ret == 0);
+    gbc->audio.audio_write = test_audio_write;
+    gbc->graphic.frame_ready = test_frame_ready;
+    ret = gbc_graphic_set_accuracy(&gbc->graphic, accuracy);
+    ret |= gbc_graphic_set_layer_cache(&gbc->graphic, layer_cache);
+    ret |= gbc_graphic_set_render_mode(&gbc->graphic, mode);
+    assert(ret == 0);
+
+    /* BG, window and objs on */
+    test_write(gbc, IO_PORT_BASE + IO_PORT_LCDC, 0xf3);
+    test_write(gbc, IO_PORT_BASE + IO_PORT_WY, 70);
+    test_write(gbc, IO_PORT_BASE + IO_PORT_WX, 50);
+
+    test_seed(9);
+    _frames_crc = 0;
+    _frames = 0;
+    for (long i = 0; i < (long)CYCLES_PER_FRAME * TEST_FRAMES; i++) {
+        if (test_rand() % TEST_WRITE_CHANCE == 0)
+            test_random_write(gbc);
+        if (format_switch && i % TEST_FORMAT_SWITCH == 0)
+            gbc_mem_set_pixel_format(&gbc->mem, i / TEST_FORMAT_SWITCH % PIXEL_FORMATS);
+        uint8_t mode = gbc->graphic.mode;
+        gbc_cpu_cycle(&gbc->cpu);
+        gbc_timer_cycle(&gbc->timer);
+        /* the events counted down inline, as gbc_run() does */
+        if (step == TEST_STEP_CYCLE)
+            gbc_graphic_cycle(&gbc->graphic);
+        else if (gbc->graphic.dots)
+            gbc->graphic.dots--;
+        else
+            gbc_graphic_event(&gbc->graphic);
+        gbc_audio_cycle(&gbc->audio);
+        if (_reference && mode == PPU_MODE_2 && gbc->graphic.mode == PPU_MODE_3)
+            test_reference_line(gbc);
+    }
+
+    gbc_graphic_sync(&gbc->graphic);
+    assert(_frames > 0);
+    printf("accuracy %d render mode %d layer cache %d step %d format switch %d: %d frames, crc %08x\n",
+        accuracy, mode, layer_cache, step, format_switch, _frames, _frames_crc);
+    return _frames_crc;
+}
+
+int
+main(int argc, char **argv)
+{
+    static gbc_t gbc;
+
+    if (argc < 2) {
+        printf("usage: %s game.gbc\n", argv[0]);
+        return 1;
+    }
+
+    for (uint8_t accuracy = 0; accuracy < PPU_ACCURACIES; accuracy++) {
+        _format_record = 1;
+        _reference = accuracy == PPU_ACCURACY_SCANLINE;
+        uint32_t expect = test_run(&gbc, argv[1], accuracy, RENDER_MODE_LINE, 0, TEST_STEP_CYCLE, 0);
+        int frames = _frames;
+        _format_record = 0;
+        if (_reference)
+            printf("%d lines as the per-pixel renderer draws them\n", _reference_lines);
+        _reference = 0;
+
+        for (uint8_t mode = RENDER_MODE_LINE; mode <= RENDER_MODE_THREAD; mode++) {
+            for (uint8_t layer_cache = 0; layer_cache < 2; layer_cache++) {
+                for (uint8_t step = TEST_STEP_CYCLE; step <= TEST_STEP_EVENT; step++) {
+                    if (mode == RENDER_MODE_LINE && !layer_cache && step == TEST_STEP_CYCLE)
+                        continue;
+                    uint32_t crc = test_run(&gbc, argv[1], accuracy, mode, layer_cache, step, 0);
+                    assert(crc == expect && _frames == frames);
+                }
+            }
+        }
+
+        _format_check = 1;
+        for (uint8_t mode = RENDER_MODE_LINE; mode <= RENDER_MODE_THREAD; mode++) {
+            test_run(&gbc, argv[1], accuracy, mode, 0, TEST_STEP_EVENT, 1);
+            assert(_frames == frames);
+        }
+        _format_check = 0;
+    }
+
+    gbc_graphic_set_render_mode(&gbc.graphic, RENDER_MODE_LINE);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,291 @@
+#include "simd.h"
+#include <assert.h>
+#include "test_util.h"
+
+/*
+Every implementation of gbc_simd_available() against the scalar one, on random input.
+The scalar one is checked against the plain definition first.
+
+Built with the GBC_BUILD_TESTS option of CMakeLists.txt.
+
+    ./test_simd
+*/
+
+#define TEST_ROUNDS 20000
+#define TEST_MAX_SIMD 8
+#define TEST_MAX_WIDTH (SIMD_LINE_PIXELS * 2 + 7)  /* odd, past a few vector widths */
+#define TEST_GUARD 0xa5a5a5a5
+
+static void
+test_guard(uint32_t *data, int size)
+{
+    for (int i = 0; i < size / 4; i++)
+        data[i] = TEST_GUARD;
+}
+
+static void
+test_tile_decode(const gbc_simd_t **list, int count)
+{
+    uint8_t data[16];
+    uint8_t pixels[64], pixels_xflip[64];
+    uint8_t expect[64], expect_xflip[64];
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        test_fill(data, sizeof(data));
+
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                uint8_t id = ((data[y * 2] >> (7 - x)) & 1) | (((data[y * 2 + 1] >> (7 - x)) & 1) << 1);
+                expect[y * 8 + x] = id;
+                expect_xflip[y * 8 + 7 - x] = id;
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            list[i]->tile_decode(data, pixels, pixels_xflip);
+            assert(memcmp(pixels, expect, sizeof(expect)) == 0);
+            assert(memcmp(pixels_xflip, expect_xflip, sizeof(expect_xflip)) == 0);
+        }
+    }
+}
+
+static void
+test_line_compose(const gbc_simd_t **list, int count)
+{
+    gbc_simd_line_t line;
+    uint8_t out[SIMD_LINE_PIXELS], expect[SIMD_LINE_PIXELS];
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        for (int x = 0; x < SIMD_LINE_PIXELS; x++) {
+            line.bg_color_id[x] = test_rand() & 3;
+            line.bg_priority[x] = test_rand() & 1;
+            line.bg_color[x] = test_rand();
+            line.obj_color_id[x] = test_rand() & 3;
+            line.obj_priority[x] = test_rand() & 1;
+            line.obj_color[x] = test_rand();
+        }
+        uint8_t bg_enable = round & 1;
+
+        for (int x = 0; x < SIMD_LINE_PIXELS; x++) {
+            uint8_t obj_shown = line.obj_color_id[x] &&
+                (!bg_enable || !line.bg_color_id[x] || (!line.bg_priority[x] && !line.obj_priority[x]));
+            expect[x] = obj_shown ? line.obj_color[x] : line.bg_color[x];
+        }
+
+        for (int i = 0; i < count; i++) {
+            list[i]->line_compose(&line, bg_enable, out);
+            assert(memcmp(out, expect, sizeof(expect)) == 0);
+        }
+    }
+}
+
+static void
+test_palette_lookup(const gbc_simd_t **list, int count)
+{
+    uint32_t palette[256];
+    uint8_t colors[SIMD_LINE_PIXELS];
+    uint32_t out[SIMD_LINE_PIXELS + 1], expect[SIMD_LINE_PIXELS + 1];
+    static const int bytes_list[] = {4, 2, 1};
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        int bytes = bytes_list[round % 3];
+        /* the pixels of a line part, any start and length */
+        int from = test_rand() % SIMD_LINE_PIXELS;
+        int size = test_rand() % (SIMD_LINE_PIXELS - from + 1);
+
+        for (int c = 0; c < 256; c++)
+            palette[c] = test_rand();
+        test_fill(colors, sizeof(colors));
+
+        /* the bytes past the end must be left alone */
+        test_guard(expect, sizeof(expect));
+        for (int x = 0; x < size; x++) {
+            uint32_t pixel = palette[colors[from + x]];
+            if (bytes == 4)
+                ((uint32_t*)expect)[x] = pixel;
+            else if (bytes == 2)
+                ((uint16_t*)expect)[x] = pixel;
+            else
+                ((uint8_t*)expect)[x] = pixel;
+        }
+
+        for (int i = 0; i < count; i++) {
+            test_guard(out, sizeof(out));
+            list[i]->palette_lookup(palette, colors + from, (uint8_t*)out, size, bytes);
+            assert(memcmp(out, expect, sizeof(expect)) == 0);
+        }
+    }
+}
+
+/* dst past width * factor pixels must be left alone */
+static void
+test_row_scale(const gbc_simd_t **list, int count)
+{
+    static uint32_t src[TEST_MAX_WIDTH];
+    static uint32_t dst[TEST_MAX_WIDTH * 8 + 8], expect[TEST_MAX_WIDTH * 8 + 8];
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        int factor = round % 8 + 1;
+        /* every width up to 32, then random ones */
+        int width = round / 8 < 32 ? round / 8 + 1 : test_rand() % TEST_MAX_WIDTH + 1;
+
+        test_fill((uint8_t*)src, width * 4);
+        test_guard(expect, sizeof(expect));
+        for (int x = 0; x < width; x++)
+            for (int i = 0; i < factor; i++)
+                expect[x * factor + i] = src[x];
+
+        for (int i = 0; i < count; i++) {
+            test_guard(dst, sizeof(dst));
+            list[i]->row_scale(src, dst, width, factor);
+            assert(memcmp(dst, expect, sizeof(expect)) == 0);
+        }
+    }
+}
+
+/* https://www.scale2x.it/algorithm, the form without the common condition */
+static void
+test_scale2x_pixel(uint32_t b, uint32_t d, uint32_t e, uint32_t f, uint32_t h, uint32_t *e0, uint32_t *e1,
+    uint32_t *e2, uint32_t *e3)
+{
+    *e0 = d == b && b != f && d != h ? d : e;
+    *e1 = b == f && b != d && f != h ? f : e;
+    *e2 = d == h && d != b && h != f ? d : e;
+    *e3 = h == f && d != h && b != f ? f : e;
+}
+
+static void
+test_row_scale2x(const gbc_simd_t **list, int count)
+{
+    static uint32_t rows[3][TEST_MAX_WIDTH];
+    static uint32_t dst[2][TEST_MAX_WIDTH * 2 + 8], expect[2][TEST_MAX_WIDTH * 2 + 8];
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        int width = round < 32 ? round + 1 : test_rand() % TEST_MAX_WIDTH + 1;
+        /* few colors, so most pixels are on an edge, and colors that only differ in one byte */
+        uint32_t colors = round & 1 ? 2 : 3;
+        uint32_t shift = (round >> 1) % 4 * 8;
+
+        for (int y = 0; y < 3; y++)
+            for (int x = 0; x < width; x++)
+                rows[y][x] = test_rand() % colors << shift;
+
+        test_guard(expect[0], sizeof(expect));
+        for (int x = 0; x < width; x++) {
+            uint32_t d = rows[1][x > 0 ? x - 1 : x], f = rows[1][x < width - 1 ? x + 1 : x];
+            test_scale2x_pixel(rows[0][x], d, rows[1][x], f, rows[2][x],
+                &expect[0][x * 2], &expect[0][x * 2 + 1], &expect[1][x * 2], &expect[1][x * 2 + 1]);
+        }
+
+        for (int i = 0; i < count; i++) {
+            test_guard(dst[0], sizeof(dst));
+            list[i]->row_scale2x(rows[0], rows[1], rows[2], dst[0], dst[1], width);
+            assert(memcmp(dst, expect, sizeof(expect)) == 0);
+        }
+    }
+}
+
+static void
+test_frame_blend(const gbc_simd_t **list, int count)
+{
+    static uint8_t prev[TEST_MAX_WIDTH * 4 + 64], cur[TEST_MAX_WIDTH * 4 + 64];
+    static uint8_t out[TEST_MAX_WIDTH * 4 + 64], expect[TEST_MAX_WIDTH * 4 + 64];
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        /* every weight, every size up to 2 AVX2 vectors, unaligned starts */
+        uint8_t weight = round;
+        int size = round < 64 ? round : test_rand() % (TEST_MAX_WIDTH * 4);
+        int offset = test_rand() % 32;
+
+        test_fill(prev, sizeof(prev));
+        test_fill(cur, sizeof(cur));
+        /* the extremes of the rounding */
+        if (round % 4 == 1)
+            memset(prev, 0xff, sizeof(prev));
+        if (round % 4 == 2)
+            memset(cur, 0xff, sizeof(cur));
+
+        memcpy(expect, cur, sizeof(cur));
+        for (int i = offset; i < offset + size; i++)
+            expect[i] = (cur[i] * (256 - weight) + prev[i] * weight + 128) >> 8;
+
+        for (int i = 0; i < count; i++) {
+            memcpy(out, cur, sizeof(cur));
+            list[i]->frame_blend(prev + offset, out + offset, size, weight);
+            assert(memcmp(out, expect, sizeof(expect)) == 0);
+        }
+    }
+}
+
+static void
+test_row_diff(const gbc_simd_t **list, int count)
+{
+    static uint8_t a[TEST_MAX_WIDTH * 4 + 32], b[TEST_MAX_WIDTH * 4 + 32];
+
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        /* every size up to 4 SSE2 vectors, then random ones, mostly not a multiple of 16 */
+        int size = round < 64 ? round : test_rand() % (TEST_MAX_WIDTH * 4);
+        int offset = test_rand() % 16 + 1;
+        int expect_first = size, expect_last = -1;
+
+        test_fill(a, sizeof(a));
+        memcpy(b, a, sizeof(b));
+        /* the bytes around the rows differ, they must not be looked at */
+        a[offset - 1]++;
+        a[offset + size]++;
+
+        switch (size ? round % 4 : 0) {
+        case 0:
+            /* no difference */
+            break;
+        case 1:
+            /* one byte in the tail past the last whole vector, or anywhere for short rows */
+            expect_first = expect_last = size < 16 ? test_rand() % size : size / 16 * 16 +
+                (size % 16 ? test_rand() % (size % 16) : -1);
+            break;
+        case 2:
+            /* one byte */
+            expect_first = expect_last = test_rand() % size;
+            break;
+        default:
+            expect_first = test_rand() % size;
+            expect_last = expect_first + test_rand() % (size - expect_first);
+            break;
+        }
+        if (expect_last >= 0) {
+            b[offset + expect_first] ^= 1 << (test_rand() % 8);
+            b[offset + expect_last] ^= 1 << (test_rand() % 8);
+            /* the same bit twice */
+            if (b[offset + expect_first] == a[offset + expect_first])
+                b[offset + expect_first] ^= 0x80;
+        }
+
+        for (int i = 0; i < count; i++) {
+            int first, last;
+            list[i]->row_diff(a + offset, b + offset, size, &first, &last);
+            assert(first == expect_first);
+            assert(last == expect_last);
+        }
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const gbc_simd_t *list[TEST_MAX_SIMD];
+    int count = gbc_simd_available(list, TEST_MAX_SIMD);
+
+    for (int i = 0; i < count; i++)
+        printf("%s\n", list[i]->name);
+
+    test_tile_decode(list, count);
+    test_line_compose(list, count);
+    test_palette_lookup(list, count);
+    test_row_scale(list, count);
+    test_row_scale2x(list, count);
+    test_frame_blend(list, count);
+    test_row_diff(list, count);
+
+    printf("ok\n");
+    return 0;
+}
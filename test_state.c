@@ -0,0 +1,169 @@
+#include "gbc.h"
+#include "state.h"
+#include <assert.h>
+#include "test_util.h"
+
+/*
+A state saved in the middle of a frame and loaded into a freshly started emulator runs on like the
+emulator it was saved from: the frames and the states saved after the same number of frames are the
+same. The game runs with random VRAM, OAM, palette, SCX, WRAM and cartridge RAM writes, the same
+ones in both runs. Both PPU accuracy tiers are checked, with frame skip off and on.
+
+Built with the GBC_BUILD_TESTS option of CMakeLists.txt.
+
+    ./test_state game.gbc
+*/
+
+#define TEST_FRAMES 60
+#define TEST_WRITE_CHANCE 40    /* a write every 40 cycles on average */
+#define TEST_SAVE_CYCLE (CYCLES_PER_FRAME * 3 + 48675)  /* in mode 3 of a line with the window */
+
+static uint32_t _frames_crc;
+static int _frames;
+static uint8_t _first_line;     /* of the first frame, the lines before it were drawn before the save */
+
+static void
+test_audio_write(int8_t left, int8_t right)
+{
+}
+
+static void
+test_frame_ready(void *udata, const void *buffer, uint16_t stride, uint8_t format)
+{
+    uint8_t line = _frames++ ? 0 : _first_line;
+
+    if (line < VISIBLE_VERTICAL_PIXELS)
+        _frames_crc = _frames_crc * 31 + checksum_crc32((const uint8_t*)buffer + line * stride,
+            (VISIBLE_VERTICAL_PIXELS - line) * stride);
+}
+
+static void
+test_write(gbc_t *gbc, uint16_t addr, uint8_t data)
+{
+    gbc->cpu.mem_write(gbc->cpu.mem_data, addr, data);
+}
+
+static void
+test_random_write(gbc_t *gbc)
+{
+    switch (test_rand() % 8) {
+    case 0:
+    case 1:
+        test_write(gbc, IO_PORT_BASE + IO_PORT_VBK, test_rand() & 1);
+        test_write(gbc, 0x8000 + test_rand() % 0x2000, test_rand());
+        break;
+    case 2:
+        test_write(gbc, 0xfe00 + test_rand() % 160, test_rand());
+        break;
+    case 3:
+        test_write(gbc, IO_PORT_BASE + IO_PORT_BCPS_BCPI, test_rand() & 0xbf);
+        test_write(gbc, IO_PORT_BASE + IO_PORT_BCPD_BGPD, test_rand());
+        break;
+    case 4:
+        test_write(gbc, IO_PORT_BASE + IO_PORT_SCX, test_rand());
+        break;
+    case 5:
+        test_write(gbc, 0xa000 + test_rand() % 0x2000, test_rand());
+        break;
+    default:
+        test_write(gbc, 0xc000 + test_rand() % 0x2000, test_rand());
+        break;
+    }
+}
+
+static void
+test_cycles(gbc_t *gbc, long cycles)
+{
+    /* no gbc_io_cycle(), there is no frontend to poll the keypad from */
+    for (long i = 0; i < cycles; i++) {
+        if (test_rand() % TEST_WRITE_CHANCE == 0)
+            test_random_write(gbc);
+        gbc_cpu_cycle(&gbc->cpu);
+        gbc_timer_cycle(&gbc->timer);
+        gbc_graphic_cycle(&gbc->graphic);
+        gbc_audio_cycle(&gbc->audio);
+    }
+}
+
+/* frame skip is a setting of the host like the accuracy, it is set again after the load */
+static void
+test_start(gbc_t *gbc, const char *rom, uint8_t accuracy)
+{
+    int ret = gbc_init(gbc, rom, NULL);
+    assert(ret == 0);
+    gbc->audio.audio_write = test_audio_write;
+    gbc->graphic.frame_ready = test_frame_ready;
+    ret = gbc_graphic_set_accuracy(&gbc->graphic, accuracy);
+    assert(ret == 0);
+}
+
+/* the crc of the frames after the save point, the state after them is in end */
+static uint32_t
+test_run(gbc_t *gbc, uint8_t frame_skip, uint8_t *end, size_t size)
+{
+    gbc_graphic_set_frame_skip(&gbc->graphic, frame_skip, 1);
+    test_seed(13);
+    _frames_crc = 0;
+    _frames = 0;
+    test_cycles(gbc, (long)CYCLES_PER_FRAME * TEST_FRAMES);
+    gbc_graphic_sync(&gbc->graphic);
+    assert(_frames > 1);
+    assert(gbc_state_save(gbc, end, size) == size);
+    return _frames_crc;
+}
+
+static void
+test_state(gbc_t *gbc, const char *rom, uint8_t accuracy, uint8_t frame_skip)
+{
+    test_start(gbc, rom, accuracy);
+    /* BG, window and objs on, the cartridge RAM enabled */
+    test_write(gbc, IO_PORT_BASE + IO_PORT_LCDC, 0xf3);
+    test_write(gbc, IO_PORT_BASE + IO_PORT_WY, 70);
+    test_write(gbc, IO_PORT_BASE + IO_PORT_WX, 50);
+    test_write(gbc, 0x0000, 0x0a);
+    test_seed(11);
+    test_cycles(gbc, TEST_SAVE_CYCLE);
+
+    size_t size = gbc_state_size(gbc);
+    uint8_t *saved = malloc(size), *end = malloc(size), *end_loaded = malloc(size);
+    assert(saved && end && end_loaded);
+    size_t n = gbc_state_save(gbc, saved, size);
+    assert(n > 0);
+    /* all the same size, the states can be compared */
+    assert(n == size);
+    _first_line = gbc->graphic.scanline + 1;
+
+    uint32_t expect = test_run(gbc, frame_skip, end, size);
+    int frames = _frames;
+
+    test_start(gbc, rom, accuracy);
+    assert(gbc_state_load(gbc, saved, n) == 0);
+    uint32_t crc = test_run(gbc, frame_skip, end_loaded, size);
+
+    printf("accuracy %d frame skip %d: %d frames, crc %08x\n", accuracy, frame_skip, _frames, crc);
+    assert(crc == expect && _frames == frames);
+    assert(memcmp(end, end_loaded, size) == 0);
+
+    free(saved);
+    free(end);
+    free(end_loaded);
+}
+
+int
+main(int argc, char **argv)
+{
+    static gbc_t gbc;
+
+    if (argc < 2) {
+        printf("usage: %s game.gbc\n", argv[0]);
+        return 1;
+    }
+
+    for (uint8_t accuracy = 0; accuracy < PPU_ACCURACIES; accuracy++) {
+        test_state(&gbc, argv[1], accuracy, FRAME_SKIP_OFF);
+        test_state(&gbc, argv[1], accuracy, FRAME_SKIP_FIXED);
+    }
+
+    printf("ok\n");
+    return 0;
+}
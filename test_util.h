@@ -0,0 +1,35 @@
+#ifndef _TEST_UTIL_H
+#define _TEST_UTIL_H
+
+#include "common.h"
+
+/*
+Shared by the test_*.c and bench_*.c programs, each one is a single source file.
+xorshift32, the same sequence on every host so a failing round can be run again.
+*/
+
+static uint32_t _test_rng = 1;
+
+static inline void
+test_seed(uint32_t seed)
+{
+    _test_rng = seed;
+}
+
+static inline uint32_t
+test_rand()
+{
+    _test_rng ^= _test_rng << 13;
+    _test_rng ^= _test_rng >> 17;
+    _test_rng ^= _test_rng << 5;
+    return _test_rng;
+}
+
+static inline void
+test_fill(void *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        ((uint8_t*)data)[i] = test_rand();
+}
+
+#endif
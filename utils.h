@@ -12,4 +12,7 @@ void free_memory(void *ptr);
 */
 uint64_t get_time(); 
 
+/* CRC-32(IEEE 802.3), the one zip uses */
+uint32_t checksum_crc32(const uint8_t *data, size_t size);
+
 #endif